@@ -5,58 +5,178 @@
 /// class for individual LED with non-blocking control
 //
 
+// What is showing
+enum {
+  LED_OFF,
+  LED_ON,
+  LED_FLASH,
+  LED_PULSE,
+  LED_COUNT,
+  LED_CODE,
+};
+
 LEDControl::LEDControl() {
 
+  _pin = 0;
+  _timer = NULL;
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+  _num_steps = 0;
+  _step = 0;
+  _repeat = false;
   _state = LOW;
-  _flash = false;
-  _lastTime = 0UL;
+  _kind = LED_OFF;
+  _arg = 0;
 }
 
-//  set the pin for this LED
+//  set the pin for this LED, 0 if not fitted
 
 void LEDControl::setPin(byte pin) {
 
+  esp_timer_create_args_t args = {};
+
   _pin = pin;
+  if (_pin == 0) {
+    return;
+  }
   pinMode(_pin, OUTPUT);
+  digitalWrite(_pin, _state);
+  if (_timer == NULL) {
+    args.callback = timer_callback;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "led";
+    esp_timer_create(&args, &_timer);
+  }
 }
 
 // turn LED state on
 
 void LEDControl::on(void) {
 
-  _state = HIGH;
-  _flash = false;
+  show(LED_ON, 0, NULL, 0, false, HIGH);
 }
 
 // turn LED state off
 
 void LEDControl::off(void) {
 
-  _state = LOW;
-  _flash = false;
+  show(LED_OFF, 0, NULL, 0, false, LOW);
 }
 
 // blink LED
 
 void LEDControl::flash(unsigned int period) {
 
-  _flash = true;
-  _period = period;
+  uint16_t steps[2] = { (uint16_t)period, (uint16_t)period };
+  show(LED_FLASH, period, steps, 2, true, LOW);
+}
+
+// one flash, then off
+
+void LEDControl::pulse(unsigned int on_ms) {
+
+  uint16_t steps[1] = { (uint16_t)on_ms };
+  // Always restarts, so each pulse() is seen
+  _kind = LED_OFF;
+  show(LED_PULSE, on_ms, steps, 1, false, LOW);
 }
 
-// actually operate the LED dependent upon its current state
-// must be called frequently from loop() if the LED is set to blink or pulse
+// session count or similar, steady on for none
 
-void LEDControl::run() {
+void LEDControl::count(byte flashes) {
 
-  if (_flash) {
+  if (flashes == 0) {
+    on();
+  }
+  else {
+    this->flashes(LED_COUNT, flashes, LED_SHORT_MS);
+  }
+}
+
+// fault code
+
+void LEDControl::code(byte code) {
 
-    // blinking
-    if ((millis() - _lastTime) >= _period) {
-      _state = !_state;
-      _lastTime = millis();
+  flashes(LED_CODE, code, LED_LONG_MS);
+}
+
+void LEDControl::flashes(byte kind, byte number, unsigned int on_ms) {
+
+  uint16_t steps[LED_MAX_STEPS];
+  byte num_steps = 0;
+
+  // No flashes at all, so nothing to repeat
+  if (number == 0) {
+    off();
+    return;
+  }
+  if (number > (LED_MAX_STEPS / 2)) {
+    number = LED_MAX_STEPS / 2;
+  }
+  for (byte n = 0; n < number; n++) {
+    steps[num_steps++] = on_ms;
+    steps[num_steps++] = LED_GAP_MS;
+  }
+  // The last gap is the pause before repeating
+  steps[num_steps - 1] = LED_PAUSE_MS;
+  show(kind, number, steps, num_steps, true, LOW);
+}
+
+// Change what the LED shows. steady is the state when there are no steps,
+// or once a pattern that does not repeat has finished.
+
+void LEDControl::show(byte kind, unsigned int arg, const uint16_t *steps, byte num_steps, bool repeat, bool steady) {
+
+  if ((kind == _kind) && (arg == _arg)) {
+    return;
+  }
+  if (_timer != NULL) {
+    esp_timer_stop(_timer);
+  }
+  portENTER_CRITICAL(&_mux);
+  _kind = kind;
+  _arg = arg;
+  memcpy(_steps, steps, num_steps * sizeof(uint16_t));
+  _num_steps = num_steps;
+  _step = 0;
+  _repeat = repeat;
+  _state = (num_steps > 0) ? HIGH : steady;
+  portEXIT_CRITICAL(&_mux);
+  if (_pin != 0) {
+    digitalWrite(_pin, _state);
+    if ((num_steps > 0) && (_timer != NULL)) {
+      esp_timer_start_once(_timer, (uint64_t)_steps[0] * 1000);
     }
   }
+}
+
+// The current step has finished, move to the next one
 
+void LEDControl::next(void) {
+
+  uint16_t duration = 0;
+
+  portENTER_CRITICAL(&_mux);
+  _step++;
+  if ((_step >= _num_steps) && _repeat) {
+    _step = 0;
+  }
+  if (_step < _num_steps) {
+    // Steps alternate on and off, starting with on
+    _state = ((_step & 1) == 0) ? HIGH : LOW;
+    duration = _steps[_step];
+  }
+  else {
+    _state = LOW;
+  }
+  portEXIT_CRITICAL(&_mux);
   digitalWrite(_pin, _state);
+  if (duration > 0) {
+    esp_timer_start_once(_timer, (uint64_t)duration * 1000);
+  }
+}
+
+void LEDControl::timer_callback(void *arg) {
+
+  ((LEDControl *)arg)->next();
 }
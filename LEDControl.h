@@ -3,28 +3,57 @@
 #define LEDControl_h
 
 #include <Arduino.h>  // for definition of byte datatype
-#include <Streaming.h>
+#include <esp_timer.h>
 
 //
 /// class to encapsulate a non-blocking LED
 //
+/// The LED is driven from its own esp_timer, which only fires at the next change of
+/// state, so nothing needs calling from loop() and a steady LED costs nothing.
+/// Patterns are a list of durations, alternately on and off starting with on, and
+/// repeat until something else is asked for. Asking for the pattern already showing
+/// does nothing, so the status can be set on every pass without restarting it.
+//
+
+const byte LED_MAX_STEPS = 32;
+const unsigned int LED_SHORT_MS = 150;     // Counted flash
+const unsigned int LED_LONG_MS = 600;      // Fault code flash
+const unsigned int LED_GAP_MS = 250;       // Between flashes
+const unsigned int LED_PAUSE_MS = 1500;    // Before a count or code repeats
 
 class LEDControl {
 
 public:
   LEDControl();
-  void virtual setPin(byte pin);
+  void setPin(byte pin);
   void on();
   void off();
+  // Equal on and off, each for period ms
   void flash(unsigned int period);
-  virtual void run();
+  // One flash of on_ms, then off
+  void pulse(unsigned int on_ms);
+  // count short flashes then a pause, repeated. A count of 0 is steady on.
+  void count(byte flashes);
+  // A fault code, code long flashes then a pause, repeated. A code of 0 is off.
+  void code(byte code);
 
 private:
   byte _pin;
+  esp_timer_handle_t _timer;
+  portMUX_TYPE _mux;
+  uint16_t _steps[LED_MAX_STEPS];
+  byte _num_steps;
+  byte _step;
+  bool _repeat;
   bool _state;
-  bool _flash;
-  unsigned int _period;
-  unsigned long _lastTime;
+  // What is showing, so that asking again does nothing
+  byte _kind;
+  unsigned int _arg;
+
+  void show(byte kind, unsigned int arg, const uint16_t *steps, byte num_steps, bool repeat, bool steady);
+  void flashes(byte kind, byte number, unsigned int on_ms);
+  void next(void);
+  static void timer_callback(void *arg);
 };
 
 #endif
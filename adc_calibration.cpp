@@ -0,0 +1,68 @@
+//
+//  adc_calibration.cpp
+//
+//  ADC linearisation for the DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <esp_adc_cal.h>
+#include "adc_calibration.h"
+
+static uint32_t identity_mv(uint32_t raw, void *context)
+{
+  return (raw * ADC_CAL_FULL_SCALE_MV) / ADC_CAL_MAX;
+}
+
+static uint32_t esp_adc_cal_mv(uint32_t raw, void *context)
+{
+  return esp_adc_cal_raw_to_voltage(raw, (esp_adc_cal_characteristics_t *)context);
+}
+
+adc_calibration::adc_calibration(void)
+{
+  for (byte unit = 0; unit < ADC_CAL_UNITS; unit++)
+  {
+    build(unit, identity_mv, NULL);
+    _source[unit] = ADC_CAL_NONE;
+  }
+}
+
+void adc_calibration::begin(void)
+{
+  esp_adc_cal_characteristics_t characteristics;
+  esp_adc_cal_value_t value;
+  for (byte unit = 0; unit < ADC_CAL_UNITS; unit++)
+  {
+    // Arduino analogRead() defaults to 12 bits and 11dB
+    value = esp_adc_cal_characterize((unit == 0) ? ADC_UNIT_1 : ADC_UNIT_2, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12,
+                                     ADC_CAL_DEFAULT_VREF, &characteristics);
+    build(unit, esp_adc_cal_mv, &characteristics);
+    switch (value)
+    {
+      case ESP_ADC_CAL_VAL_EFUSE_TP:
+        _source[unit] = ADC_CAL_TWO_POINT;
+        break;
+      case ESP_ADC_CAL_VAL_EFUSE_VREF:
+        _source[unit] = ADC_CAL_EFUSE_VREF;
+        break;
+      default:
+        _source[unit] = ADC_CAL_DEFAULT;
+        break;
+    }
+  }
+}
+
+void adc_calibration::build(byte unit, t_adc_to_mv to_mv, void *context)
+{
+  uint32_t raw;
+  uint32_t level;
+  for (unsigned int point = 0; point <= ADC_CAL_POINTS; point++)
+  {
+    raw = min((uint32_t)(point << ADC_CAL_SHIFT), (uint32_t)ADC_CAL_MAX);
+    level = (to_mv(raw, context) * ADC_CAL_MAX) / ADC_CAL_FULL_SCALE_MV;
+    _lut[unit][point] = min(level, (uint32_t)ADC_CAL_MAX);
+  }
+}
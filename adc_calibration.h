@@ -0,0 +1,65 @@
+//
+//  adc_calibration.h
+//
+//  ADC linearisation for the DC controller.
+//
+//  The ESP32 ADC is not linear, least of all near the ends of its range, which
+//  distorts low BEMF readings. At start up the characterisation the chip carries in
+//  eFuse (two point values if present, otherwise the measured Vref, otherwise a
+//  default Vref) is turned into a lookup table for each ADC unit. A reading is then a
+//  table lookup and an interpolation over the low two bits, with no floating point.
+//  Readings stay in ADC counts (0..ADC_CAL_MAX), scaled so that ADC_CAL_FULL_SCALE_MV
+//  is full scale, so the levels and thresholds elsewhere keep their meaning.
+//  Before begin() the table is a straight line, so early readings are the raw values.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef adc_calibration_h
+#define adc_calibration_h
+
+#include <arduino.h>
+
+const int ADC_CAL_MAX = 4095;                 // 12 bit readings
+const byte ADC_CAL_SHIFT = 2;                 // Table entry every 4 counts
+const unsigned int ADC_CAL_POINTS = (ADC_CAL_MAX + 1) >> ADC_CAL_SHIFT;
+const uint32_t ADC_CAL_FULL_SCALE_MV = 3100;  // Top of the range at 11dB attenuation
+const uint32_t ADC_CAL_DEFAULT_VREF = 1100;   // Used if the chip has no eFuse calibration
+const byte ADC_CAL_UNITS = 2;
+
+typedef enum
+{
+  ADC_CAL_NONE,                               // Not built, readings are raw
+  ADC_CAL_TWO_POINT,
+  ADC_CAL_EFUSE_VREF,
+  ADC_CAL_DEFAULT,
+} t_adc_cal_source;
+
+// Raw reading to millivolts, for building a table
+typedef uint32_t (*t_adc_to_mv)(uint32_t raw, void *context);
+
+class adc_calibration
+{
+  uint16_t _lut[ADC_CAL_UNITS][ADC_CAL_POINTS + 1];
+  t_adc_cal_source _source[ADC_CAL_UNITS];
+
+public:
+  adc_calibration(void);
+  // Build the tables from the chip's calibration
+  void begin(void);
+  // Build one unit's table from any characterisation, so recorded curves can be used
+  void build(byte unit, t_adc_to_mv to_mv, void *context);
+  t_adc_cal_source source(byte unit) { return _source[unit]; }
+  int linearise(byte unit, int raw)
+  {
+    const uint16_t *entry = &_lut[unit][raw >> ADC_CAL_SHIFT];
+    int fraction = raw & ((1 << ADC_CAL_SHIFT) - 1);
+    return entry[0] + (((entry[1] - entry[0]) * fraction) >> ADC_CAL_SHIFT);
+  }
+  // ADC1 channels are 0..9, ADC2 channels 10 and up
+  static byte unit(byte pin) { return (digitalPinToAnalogChannel(pin) >= 10) ? 1 : 0; }
+  int read(byte pin) { return linearise(unit(pin), analogRead(pin)); }
+};
+
+#endif
@@ -0,0 +1,112 @@
+//
+//  brake_profile.cpp
+//
+//  Station stop / brake to target profile for the DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "brake_profile.h"
+
+brake_profile::brake_profile(void)
+{
+  // Raised cosine, so braking starts and finishes gently.
+  // Its average is half full scale, the same as a straight line, which the distance calculation relies on.
+  for (int point = 0; point < BRAKE_CURVE_POINTS; point++)
+  {
+    _curve[point] = (byte)(0.5 + (BRAKE_CURVE_SCALE * 0.5 * (1.0 + cos((PI * point) / (BRAKE_CURVE_POINTS - 1)))));
+  }
+  _state = BRAKE_IDLE;
+  configure(0, 30, 10, 0);
+}
+
+// Distance in cm (0 to brake by time), brake time in tenths of a second,
+// dwell in seconds and speed at full throttle in cm/s
+void brake_profile::configure(unsigned int distance_cm, unsigned int brake_ds, unsigned int dwell_s, unsigned int scale_speed_cms)
+{
+  _distance_cm = distance_cm;
+  _brake_ms = brake_ds * 100UL;
+  _dwell_ms = dwell_s * 1000UL;
+  _scale_speed_cms = scale_speed_cms;
+}
+
+// Curve movement per waveform cycle to cover the whole curve in time_ms
+uint32_t brake_profile::step_for(unsigned long time_ms)
+{
+  unsigned long cycles;
+  if (time_ms < BRAKE_MIN_TIME)
+  {
+    time_ms = BRAKE_MIN_TIME;
+  }
+  // One phase per ms, so a cycle is MAX_PHASE ms
+  cycles = time_ms / MAX_PHASE;
+  return ((uint32_t)(BRAKE_CURVE_POINTS - 1) << 16) / cycles;
+}
+
+void brake_profile::start(int requested_level)
+{
+  unsigned long brake_ms = _brake_ms;
+  unsigned long speed_cms;
+  if ((_distance_cm > 0) && (_scale_speed_cms > 0))
+  {
+    speed_cms = ((unsigned long)requested_level * _scale_speed_cms) / MAX_THROTTLE_LEVEL;
+    if (speed_cms > 0)
+    {
+      // Average speed over the curve is half the starting speed
+      brake_ms = (2000UL * _distance_cm) / speed_cms;
+    }
+  }
+  _step = step_for(brake_ms);
+  _position = 0;
+  _state = BRAKE_BRAKING;
+}
+
+void brake_profile::cancel(void)
+{
+  _state = BRAKE_IDLE;
+}
+
+int brake_profile::apply(int requested_level)
+{
+  const uint32_t end = (uint32_t)(BRAKE_CURVE_POINTS - 1) << 16;
+  switch (_state)
+  {
+    case BRAKE_BRAKING:
+      _position += _step;
+      if (_position >= end)
+      {
+        _position = end;
+        _dwell_cycles = _dwell_ms / MAX_PHASE;
+        _state = BRAKE_DWELL;
+        return 0;
+      }
+      break;
+
+    case BRAKE_DWELL:
+      if (_dwell_cycles > 0)
+      {
+        _dwell_cycles--;
+      }
+      else
+      {
+        _state = BRAKE_RESTARTING;
+      }
+      return 0;
+
+    case BRAKE_RESTARTING:
+      if (_position <= _step)
+      {
+        _state = BRAKE_IDLE;
+        return requested_level;
+      }
+      _position -= _step;
+      break;
+
+    default:
+      return requested_level;
+  }
+  return ((long)requested_level * _curve[_position >> 16]) / BRAKE_CURVE_SCALE;
+}
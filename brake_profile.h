@@ -0,0 +1,63 @@
+//
+//  brake_profile.h
+//
+//  Station stop / brake to target profile for the DC controller.
+//
+//  When started, the requested level is brought down to a stop along a precomputed
+//  braking curve, held at zero for the dwell time, then brought back up along the same curve.
+//  It is stepped once per waveform cycle from dc_controller::wave(), so no CBUS traffic
+//  is needed while it runs and stopping does not depend on bus latency.
+//  The stop is set either by distance, using the scale speed at full throttle,
+//  or by time.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef brake_profile_h
+#define brake_profile_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+
+const int BRAKE_CURVE_POINTS = 64;         // Points in the precomputed braking curve
+const int BRAKE_CURVE_SCALE = 255;         // Full scale of the braking curve
+const unsigned long BRAKE_MIN_TIME = 250;  // Shortest brake or restart, ms
+
+// Station stop settings for the CBUS build are stored in NVs, see cbus_module_defs.h
+
+typedef enum
+{
+  BRAKE_IDLE,
+  BRAKE_BRAKING,
+  BRAKE_DWELL,
+  BRAKE_RESTARTING,
+} t_brake_state;
+
+class brake_profile
+{
+  byte _curve[BRAKE_CURVE_POINTS];
+  t_brake_state _state;
+  unsigned int _distance_cm;
+  unsigned long _brake_ms;
+  unsigned long _dwell_ms;
+  unsigned int _scale_speed_cms;
+  // Curve position, 16.16 fixed point, and the amount it moves on each cycle
+  uint32_t _position;
+  uint32_t _step;
+  unsigned long _dwell_cycles;
+
+  uint32_t step_for(unsigned long time_ms);
+
+public:
+  brake_profile(void);
+  void configure(unsigned int distance_cm, unsigned int brake_ds, unsigned int dwell_s, unsigned int scale_speed_cms);
+  // Begin a stop from the given requested level
+  void start(int requested_level);
+  void cancel(void);
+  bool active(void) { return (_state != BRAKE_IDLE); }
+  // Called once per waveform cycle, returns the level to use in place of the requested level
+  int apply(int requested_level);
+};
+
+#endif
@@ -0,0 +1,205 @@
+//
+//  cbus_dc_actions.cpp
+//
+//  Event driven controller actions for the CBUS DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <CBUSconfig.h>             // module configuration
+#include <cbusdefs.h>               // MERG CBUS constants
+#include "cbus_module_defs.h"
+#include "dc_controller_defs.h"
+#include "cbus_dc_sessions.h"
+#include "cbus_dc_event_index.h"
+#include "cbus_dc_actions.h"
+#include "dc_controller.h"
+
+extern cbus_dc_sessions SessionMngr;
+extern dc_controller Controller;
+
+//
+// Action handlers, one per t_action
+//
+
+// Set speed and direction (top bit set for forwards) and tell the cabs
+static void apply_speed_dir(byte controllerIndex, byte speed_dir)
+{
+  SessionMngr.setSpeedAndDirection(controllerIndex, speed_dir, 0);
+  if (controllers.session[controllerIndex] != SF_INACTIVE)
+  {
+    SessionMngr.notifyDSPD(controllerIndex);
+  }
+}
+
+static byte direction_bit(byte controllerIndex)
+{
+  return (controllers.trainController[controllerIndex].getDirection() == SF_FORWARDS) ? 0x80 : 0;
+}
+
+static void action_none(byte controllerIndex, byte param)
+{
+  ;
+}
+
+static void action_stop(byte controllerIndex, byte param)
+{
+  apply_speed_dir(controllerIndex, direction_bit(controllerIndex));
+}
+
+static void action_emergency_stop(byte controllerIndex, byte param)
+{
+  // Speed step 1 is emergency stop
+  apply_speed_dir(controllerIndex, direction_bit(controllerIndex) | 1);
+}
+
+static void action_speed_preset(byte controllerIndex, byte param)
+{
+  apply_speed_dir(controllerIndex, direction_bit(controllerIndex) | (param & 0x7f));
+}
+
+static void action_forwards(byte controllerIndex, byte param)
+{
+  apply_speed_dir(controllerIndex, 0x80 | controllers.trainController[controllerIndex].getSpeed());
+}
+
+static void action_reverse(byte controllerIndex, byte param)
+{
+  apply_speed_dir(controllerIndex, controllers.trainController[controllerIndex].getSpeed());
+}
+
+static void action_toggle_direction(byte controllerIndex, byte param)
+{
+  apply_speed_dir(controllerIndex, (direction_bit(controllerIndex) ^ 0x80) | controllers.trainController[controllerIndex].getSpeed());
+}
+
+// There is one dc_controller per module, so BEMF mode applies to it whatever the controller index
+static void action_bemf_on(byte controllerIndex, byte param)
+{
+  Controller.set_wave_mode(MODE_TRIANGLE_BEMF);
+}
+
+static void action_bemf_off(byte controllerIndex, byte param)
+{
+  Controller.set_wave_mode(MODE_TRIANGLE);
+}
+
+static void action_station_stop(byte controllerIndex, byte param)
+{
+  Controller.station_stop();
+}
+
+static const t_action_handler action_handlers[ACTION_COUNT] =
+{
+  action_none,
+  action_stop,
+  action_emergency_stop,
+  action_speed_preset,
+  action_forwards,
+  action_reverse,
+  action_toggle_direction,
+  action_bemf_on,
+  action_bemf_off,
+  action_station_stop
+};
+
+cbus_dc_actions::cbus_dc_actions(void)
+{
+  _index = NULL;
+  _table = NULL;
+  _max_events = 0;
+  _generation = 0;
+}
+
+void cbus_dc_actions::begin(cbus_dc_event_index *index)
+{
+  _index = index;
+  _max_events = index->maxEvents();
+  _table = new t_action_entry[_max_events];
+  compile();
+}
+
+t_action_handler cbus_dc_actions::handler(byte action)
+{
+  if (action >= ACTION_COUNT)
+  {
+    return action_none;
+  }
+  return action_handlers[action];
+}
+
+// Turn the EVs of every learned event into a table entry.
+// Anything not learned, or aimed at a controller we do not have, does nothing.
+void cbus_dc_actions::compile(void)
+{
+  t_action_entry *entry;
+  for (byte index = 0; index < _max_events; index++)
+  {
+    entry = &_table[index];
+    entry->controllerIndex = _index->ev(index, EV_ACTION_CONTROLLER);
+    entry->param = _index->ev(index, EV_ACTION_PARAM);
+    if (entry->controllerIndex < NUM_CONTROLLERS)
+    {
+      entry->on = handler(_index->ev(index, EV_ACTION_ON));
+      entry->off = handler(_index->ev(index, EV_ACTION_OFF));
+    }
+    else
+    {
+      entry->controllerIndex = 0;
+      entry->on = action_none;
+      entry->off = action_none;
+    }
+  }
+  _generation = _index->generation();
+}
+
+void cbus_dc_actions::refresh(void)
+{
+  if (_generation != _index->generation())
+  {
+    compile();
+  }
+}
+
+void cbus_dc_actions::dispatch(byte index, byte opcode)
+{
+  t_action_entry *entry;
+  if (index >= _max_events)
+  {
+    return;
+  }
+  entry = &_table[index];
+  switch (opcode)
+  {
+    case OPC_ACON:
+    case OPC_ACON1:
+    case OPC_ACON2:
+    case OPC_ACON3:
+    case OPC_ASON:
+    case OPC_ASON1:
+    case OPC_ASON2:
+    case OPC_ASON3:
+    case OPC_ARON:
+    case OPC_ARSON:
+      entry->on(entry->controllerIndex, entry->param);
+      break;
+
+    case OPC_ACOF:
+    case OPC_ACOF1:
+    case OPC_ACOF2:
+    case OPC_ACOF3:
+    case OPC_ASOF:
+    case OPC_ASOF1:
+    case OPC_ASOF2:
+    case OPC_ASOF3:
+    case OPC_AROF:
+    case OPC_ARSOF:
+      entry->off(entry->controllerIndex, entry->param);
+      break;
+
+    default:
+      break;
+  }
+}
@@ -0,0 +1,75 @@
+//
+//  cbus_dc_actions.h
+//
+//  Event driven controller actions for the CBUS DC controller.
+//
+//  Learned events are mapped on to controller actions by their EVs:
+//    EV1 - action for the ON event (ACON, ASON, ARON, ARSON)
+//    EV2 - action for the OFF event (ACOF, ASOF, AROF, ARSOF)
+//    EV3 - controller index the actions apply to
+//    EV4 - parameter, e.g. the speed step for a speed preset
+//  The EVs are compiled into a flat table, indexed by event table index, whenever the
+//  event index changes, so handling an event is a table read and one indirect call.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_actions_h
+#define cbus_dc_actions_h
+
+#include <arduino.h>
+#include <CBUSconfig.h>             // module configuration
+#include "cbus_dc_event_index.h"
+
+const byte EV_ACTION_ON = 1;
+const byte EV_ACTION_OFF = 2;
+const byte EV_ACTION_CONTROLLER = 3;
+const byte EV_ACTION_PARAM = 4;
+const byte ACTION_NUM_EVS = 4;      // EVs per event needed by the action engine
+
+typedef enum : byte
+{
+  ACTION_NONE,
+  ACTION_STOP,                      // Ramp down to a stop
+  ACTION_EMERGENCY_STOP,            // Stop now
+  ACTION_SPEED_PRESET,              // Set speed to EV4, direction unchanged
+  ACTION_FORWARDS,                  // Set direction forwards, speed unchanged
+  ACTION_REVERSE,                   // Set direction reverse, speed unchanged
+  ACTION_TOGGLE_DIRECTION,
+  ACTION_BEMF_ON,                   // Regulate speed using BEMF
+  ACTION_BEMF_OFF,                  // Triangle wave output, no regulation
+  ACTION_STATION_STOP,              // Brake to a stop, dwell, then restart
+  ACTION_COUNT
+} t_action;
+
+typedef void (*t_action_handler)(byte controllerIndex, byte param);
+
+typedef struct
+{
+  t_action_handler on;
+  t_action_handler off;
+  byte controllerIndex;
+  byte param;
+} t_action_entry;
+
+class cbus_dc_actions
+{
+  cbus_dc_event_index *_index;
+  t_action_entry *_table;
+  byte _max_events;
+  uint16_t _generation;
+
+  t_action_handler handler(byte action);
+
+public:
+  cbus_dc_actions(void);
+  void begin(cbus_dc_event_index *index);
+  // Rebuild the table if the event index has changed since it was compiled, call from loop()
+  void refresh(void);
+  void compile(void);
+  // Run the action for a learned event, called from the event handler
+  void dispatch(byte index, byte opcode);
+};
+
+#endif
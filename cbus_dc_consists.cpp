@@ -0,0 +1,104 @@
+//
+//  cbus_dc_consists.cpp
+//
+//  Consist engine for the CBUS DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "cbus_module_defs.h"
+#include "cbus_dc_consists.h"
+
+cbus_dc_consists::cbus_dc_consists(void)
+{
+  clear();
+}
+
+void cbus_dc_consists::clear(void)
+{
+  memset(_slot, CONSIST_NONE, sizeof(_slot));
+  for (byte slot = 0; slot < MAX_CONSISTS; slot++)
+  {
+    _consists[slot].address = 0;
+    _consists[slot].count = 0;
+    _consists[slot].reverse = 0;
+  }
+}
+
+// Slot for an address, taking a free one if the consist is new
+byte cbus_dc_consists::allocate(byte address)
+{
+  if (_slot[address] != CONSIST_NONE)
+  {
+    return _slot[address];
+  }
+  for (byte slot = 0; slot < MAX_CONSISTS; slot++)
+  {
+    if (_consists[slot].address == 0)
+    {
+      _consists[slot].address = address;
+      _consists[slot].count = 0;
+      _consists[slot].reverse = 0;
+      _slot[address] = slot;
+      return slot;
+    }
+  }
+  return CONSIST_NONE;
+}
+
+bool cbus_dc_consists::add(byte controllerIndex, byte consist)
+{
+  byte address = consist & 0x7f;
+  byte slot;
+  t_consist *entry;
+  if ((address == 0) || (controllerIndex >= NUM_CONTROLLERS))
+  {
+    return false;
+  }
+  // A controller can only be in one consist
+  remove(controllerIndex);
+  slot = allocate(address);
+  if (slot == CONSIST_NONE)
+  {
+    return false;
+  }
+  entry = &_consists[slot];
+  entry->members[entry->count] = controllerIndex;
+  if (consist & 0x80)
+  {
+    entry->reverse |= (1UL << entry->count);
+  }
+  entry->count++;
+  return true;
+}
+
+void cbus_dc_consists::remove(byte controllerIndex)
+{
+  t_consist *entry;
+  uint32_t low_mask;
+  for (byte slot = 0; slot < MAX_CONSISTS; slot++)
+  {
+    entry = &_consists[slot];
+    for (byte member = 0; member < entry->count; member++)
+    {
+      if (entry->members[member] != controllerIndex)
+      {
+        continue;
+      }
+      // Close the gap in the member list, and in the reverse mask to match
+      memmove(&entry->members[member], &entry->members[member + 1], entry->count - member - 1);
+      low_mask = (1UL << member) - 1;
+      entry->reverse = (entry->reverse & low_mask) | ((entry->reverse >> 1) & ~low_mask);
+      entry->count--;
+      if (entry->count == 0)
+      {
+        _slot[entry->address] = CONSIST_NONE;
+        entry->address = 0;
+        entry->reverse = 0;
+      }
+      return;
+    }
+  }
+}
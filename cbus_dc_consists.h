@@ -0,0 +1,60 @@
+//
+//  cbus_dc_consists.h
+//
+//  Consist engine for the CBUS DC controller.
+//
+//  Each consist on this module is a compact list of member controller indexes,
+//  with a bit mask of the members that run reversed. A consist is found from its
+//  consist session, which is the address with the top bit set, through a 128 entry
+//  table, so applying a DSPD to every member is one lookup and one pass.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_consists_h
+#define cbus_dc_consists_h
+
+#include <arduino.h>
+#include "cbus_module_defs.h"
+
+const byte MAX_CONSISTS = NUM_CONTROLLERS;   // Every controller could be in a different consist
+const byte CONSIST_NONE = 0xff;
+const byte CONSIST_ADDRESSES = 128;           // Consists use DCC short addresses 1..127
+
+typedef struct
+{
+  byte address;                        // DCC short address of the consist, 0 if this slot is free
+  byte count;                          // Members in use
+  uint32_t reverse;                    // Bit set for each member that runs reversed
+  byte members[NUM_CONTROLLERS];       // Controller index of each member
+} t_consist;
+
+class cbus_dc_consists
+{
+  t_consist _consists[MAX_CONSISTS];
+  byte _slot[CONSIST_ADDRESSES];       // Consist slot for each address, CONSIST_NONE if none
+
+  byte allocate(byte address);
+
+public:
+  cbus_dc_consists(void);
+  void clear(void);
+  // Add a controller to a consist, top bit of consist set for reversed running
+  bool add(byte controllerIndex, byte consist);
+  // Take a controller out of whichever consist it is in
+  void remove(byte controllerIndex);
+  // The consist for a consist session, NULL if none. Loco sessions (top bit clear)
+  // share numbers with consist addresses, so never match.
+  const t_consist *find(byte session)
+  {
+    if ((session & 0x80) == 0)
+    {
+      return NULL;
+    }
+    byte slot = _slot[session & 0x7f];
+    return (slot == CONSIST_NONE) ? NULL : &_consists[slot];
+  }
+};
+
+#endif
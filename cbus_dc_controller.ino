@@ -58,17 +58,29 @@
 #include "cbus_dc_sessions.h"        // CBUS session functions
 #include "cbus_dc_messages.h"        // CBUS message functions
 #include "cbus_dc_session_messages.h"
+#include "cbus_dc_snapshot.h"
+#include "cbus_dc_event_index.h"
+#include "cbus_dc_actions.h"
+#include "cbus_dc_coordinator.h"
+#include "cbus_dc_long_messages.h"
+#include "cbus_dc_metrics.h"
+#include "cbus_dc_serial_interpreter.h"
+#include "task_scheduler.h"
+#include "LEDControl.h"
+#include "motor_profile.h"
+#include "adc_calibration.h"
 #include "dc_controller.h"
+#include "brake_profile.h"
 #include "throttle.h"
 #include "trainController.h"
 
 // CBUS objects
-#define CBUSDAC 1
 #define module_config config        // Required for CUS library linker
 CBUSConfig module_config;           // configuration object
 CBUSESP32 CBUS(&module_config);     // CBUS object
 CBUSLED ledGrn, ledYlw;             // two LED objects
 CBUSSwitch pb_switch;               // switch object
+LEDControl statusLed;               // session count and fault codes
 
 // module name
 unsigned char mname[7] = { 'D', 'C', 'C', 'O', 'N', ' ', ' ' };
@@ -76,12 +88,36 @@ unsigned char mname[7] = { 'D', 'C', 'C', 'O', 'N', ' ', ' ' };
 // forward function declarations
 void eventhandler(byte index, byte opc);
 void framehandler(CANFrame *msg);
+void longmessagehandler(byte *fragment, unsigned int fragment_len, byte stream_id, byte status);
+void waveTask();
+void cbusTask();
+void reportTask();
+void serialTask();
+void inertiaTask();
+void housekeepingTask();
+void sessionTimeoutTask();
+void showFault(byte code);
 
 // Object definitions
+adc_calibration AdcCal;
 dc_controller Controller;
 cbus_dc_messages Messenger;
 cbus_dc_sessions SessionMngr;
 cbus_dc_session_messages SessionMessageMngr;
+cbus_dc_snapshot Snapshot;
+cbus_dc_event_index EventIndex;
+cbus_dc_actions Actions;
+cbus_dc_coordinator Coordinator;
+cbus_dc_long_messages LongMessages(&CBUS);
+cbus_dc_metrics Metrics;
+task_scheduler Scheduler;
+motor_profiles MotorProfiles;
+
+unsigned long process_start_us = 0;   // when this pass of CBUS.process() started, for ESTOP latency
+// Set when an NV may have changed, so the speed curves are reloaded
+volatile bool nvs_changed = false;
+bool faultShowing = false;
+unsigned long faultShownAt = 0;
 //
 /// setup - runs once at power on
 //
@@ -93,21 +129,26 @@ void setup() {
 
   // set config layout parameters
   module_config.EE_NVS_START = 10;
-  module_config.EE_NUM_NVS = 10;
+  module_config.EE_NUM_NVS = MODULE_NUM_NVS;
   module_config.EE_EVENTS_START = 50;
   module_config.EE_MAX_EVENTS = 64;
-  module_config.EE_NUM_EVS = 1;
+  module_config.EE_NUM_EVS = ACTION_NUM_EVS;
   module_config.EE_BYTES_PER_EVENT = (module_config.EE_NUM_EVS + 4);
 
   // initialise and load configuration
   module_config.setEEPROMtype(EEPROM_INTERNAL);
   module_config.begin();
 
+  // mirror the learned event table into RAM
+  EventIndex.begin(&module_config);
+  // and compile the event actions from it
+  Actions.begin(&EventIndex);
+
   Serial << "> mode = " << (module_config.FLiM ? "FLiM" : "SLiM") << "> NN = " << module_config.nodeNum << endl;
 
   CBUSParams params(module_config);
   params.setVersion(1, 0, 0);
-  params.setModuleId(100);
+  params.setModuleId(MODULE_ID);
   params.setFlags(PF_FLiM | PF_COMBI);
 
   // assign to CBUS
@@ -121,6 +162,10 @@ void setup() {
   // initialise CBUS switch
   pb_switch.setPin(PIN_CBUS_SW, LOW);
 
+  // status LED, steady on until there are sessions
+  statusLed.setPin(PIN_STATUS_LED);
+  statusLed.on();
+
   // module reset - if switch is depressed at startup and module is in SLiM mode
   pb_switch.run();
 
@@ -151,8 +196,54 @@ void setup() {
     Serial << "> error starting CBUS" << endl;
   }
 
+  // long message channel for the PC tool
+  LongMessages.begin(longmessagehandler);
+
+  // runtime counters, readable as virtual NVs
+  Metrics.begin(&module_config);
+
+  // serial command shell
+  cbus_serial_setup(&module_config);
+
+  // start listening for other DC controller modules before claiming leadership
+  Coordinator.begin(&module_config);
+
+  // ADC linearisation first, BEMF readings go through it
+  AdcCal.begin();
   Controller = dc_controller();  // Instantiate and initialise dc_controller
+
+  // Expand per-controller speed curves from NVs
+  SessionMngr.loadSpeedCurves(module_config);
+  loadStationStop();
+
+  // Motor characterisation for BEMF regulation, by DCC address
+  MotorProfiles.begin();
+  SessionMngr.loadMotorProfiles();
+
+  // Resume sessions if this was a brown-out or watchdog reset, otherwise start clean
+  Snapshot.begin();
+  if (Snapshot.warmStartPossible() && (Snapshot.restore() > 0))
+  {
+    SessionMngr.rebuildConsists();
+    SessionMngr.claimSessions();
+    Serial << "> warm start, sessions resumed" << endl;
+  }
+  else
+  {
+    SessionMngr.setup();
+    Snapshot.clear();
+  }
   
+  // tasks, highest priority first
+  Scheduler.add("wave", waveTask, 1000);
+  Scheduler.add("cbus", cbusTask, 2000);
+  Scheduler.add("report", reportTask, 10000);
+  Scheduler.add("serial", serialTask, 5000);
+  Scheduler.add("inertia", inertiaTask, 100000);
+  Scheduler.add("housekeeping", housekeepingTask, 50000);
+  Scheduler.add("sessions", sessionTimeoutTask, 1000000);
+  Scheduler.start();
+
   // end of setup
   Serial << "> ready" << endl;
 
@@ -170,20 +261,122 @@ void setup() {
 
 void loop() {
 
-  //
-  /// do CBUS message, switch and LED processing
-  //
+  Scheduler.run();
+}
+
+//
+/// scheduled tasks, highest priority first
+//
+
+// waveform, one tick every 1ms
+void waveTask() {
+
+  Controller.tick();
+}
+
+// CBUS message, switch and LED processing
+void cbusTask() {
 
+  process_start_us = micros();
   CBUS.process();
 
-  //
-  /// do CBUS message, switch and LED processing
-  //
-  // check reversing switch
-  
-  Controller.update();
-  // Delay is included in above call
+  // bring the event index up to date with anything learned or unlearned
+  EventIndex.refresh();
+  Actions.refresh();
+
+  // NVs are written by the library after the frame handler has run, so reload here
+  if (nvs_changed)
+  {
+    nvs_changed = false;
+    SessionMngr.loadSpeedCurves(module_config);
+    loadStationStop();
+  }
+
+  // Send and receive long messages
+  LongMessages.process();
+}
+
+// reports from the controller, and speeds to the cabs
+void reportTask() {
+
+  // Report how quickly an emergency stop cut the outputs
+  if (Controller.estop_report())
+  {
+    Serial << "> ESTOP outputs cut in " << Controller.estop_latency_us() << " us" << endl;
+    showFault(FAULT_ESTOP);
+  }
+
+  // Tell the cabs about any output overload
+  if (Controller.overload_report())
+  {
+    SessionMngr.reportOverload();
+    showFault(FAULT_OVERLOAD);
+  }
+
+  // Status LED shows the number of sessions, once any fault has been shown long enough
+  if (faultShowing && ((millis() - faultShownAt) >= FAULT_SHOW_MS))
+  {
+    faultShowing = false;
+  }
+  if (!faultShowing)
+  {
+    statusLed.count(__builtin_popcount(controllers.active));
+  }
+
+  // Tell the cabs about speeds changed here rather than by them
+  SessionMngr.publishDSPD();
+}
+
+// serial commands, and any listing in progress
+void serialTask() {
 
+  processSerialInput();
+}
+
+// step speeds towards their targets
+void inertiaTask() {
+
+  SessionMngr.updateProcessing(true);
+}
+
+// snapshot, other modules and the command station
+void housekeepingTask() {
+
+  // Keep the session snapshot up to date for warm start
+  Snapshot.update();
+
+  // Heartbeat and leader election with the other DC controller modules
+  Coordinator.update();
+
+  // Take over session allocation if the CANCMD has stopped answering
+  SessionMngr.checkCommandStation();
+}
+
+// session timeouts, counted in seconds
+void sessionTimeoutTask() {
+
+  SessionMngr.increment();
+}
+
+//
+/// flash a fault code on the status LED for a while
+//
+
+void showFault(byte code) {
+
+  statusLed.code(code);
+  faultShowing = true;
+  faultShownAt = millis();
+}
+
+//
+/// station stop settings from NVs
+//
+
+void loadStationStop() {
+
+  Controller.configure_station_stop(module_config.readNV(NV_BRAKE_DISTANCE), module_config.readNV(NV_BRAKE_TIME),
+                                    module_config.readNV(NV_BRAKE_DWELL), module_config.readNV(NV_BRAKE_SCALE_SPEED));
 }
 
 //
@@ -195,10 +388,16 @@ void loop() {
 void eventhandler(byte index, CANFrame *msg) {
 
   Messenger.eventhandler(index, msg);
- 
-  // For debug, display the opcode of this event
+}
 
-  Serial << "> event handler: index = " << index << ", opcode = 0x" << _HEX(msg->data[0]) << endl;
+//
+/// user-defined long message processing function
+/// called from the CBUS library with each fragment of a long message received
+//
+
+void longmessagehandler(byte *fragment, unsigned int fragment_len, byte stream_id, byte status) {
+
+  Messenger.longmessagehandler(fragment, fragment_len, stream_id, status);
 }
 
 //
@@ -209,7 +408,27 @@ void eventhandler(byte index, CANFrame *msg) {
 
 
 void framehandler(CANFrame *msg) {
-  Messenger.framehandler(msg);
+  // Emergency stop fast lane - cut the outputs before anything else looks at the frame
+  if ((msg->len > 0) && ((msg->data[0] == OPC_RESTP) || (msg->data[0] == OPC_ESTOP)))
+  {
+    Controller.emergency_stop(process_start_us);
+    Metrics.estop();
+  }
+
+  if (msg->len > 0)
+  {
+    Metrics.frameReceived(msg->data[0]);
+  }
+  Metrics.noteFrame(msg);
+
+  Coordinator.noteFrame(msg);
+  SessionMessageMngr.framehandler(msg);
+  EventIndex.noteFrame(msg);
+
+  if (msg->data[0] == OPC_NVSET)
+  {
+    nvs_changed = true;
+  }
 
   // as an example, format and display the received frame
   char fbuff[40], dbuff[8];
@@ -0,0 +1,218 @@
+//
+//  cbus_dc_coordinator.cpp
+//
+//  Coordination between several CBUS DC controller modules on one bus.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include <CBUSconfig.h>             // module configuration
+#include <cbusdefs.h>               // MERG CBUS constants
+#include "cbus_module_defs.h"
+#include "cbus_dc_sessions.h"
+#include "cbus_frame.h"
+#include "cbus_dc_coordinator.h"
+
+extern bool cancmd_present;
+
+cbus_dc_coordinator::cbus_dc_coordinator(void)
+{
+  _config = NULL;
+  memset(_peers, 0, sizeof(_peers));
+  memset(_local, 0, sizeof(_local));
+  memset(_in_use, 0, sizeof(_in_use));
+  _next_page = 0;
+  _started = 0;
+  _last_heartbeat = 0;
+  _leader = false;
+}
+
+void cbus_dc_coordinator::begin(CBUSConfig *config)
+{
+  _config = config;
+  _started = millis();
+  _last_heartbeat = _started;
+}
+
+// Find a peer by CAN ID, adding it if asked and there is room
+t_peer *cbus_dc_coordinator::peer(byte canid, bool add)
+{
+  t_peer *free_entry = NULL;
+  for (byte i = 0; i < COORD_MAX_PEERS; i++)
+  {
+    if (_peers[i].canid == canid)
+    {
+      return &_peers[i];
+    }
+    if ((_peers[i].canid == 0) && (free_entry == NULL))
+    {
+      free_entry = &_peers[i];
+    }
+  }
+  if (add && (free_entry != NULL))
+  {
+    memset(free_entry, 0, sizeof(t_peer));
+    free_entry->canid = canid;
+    return free_entry;
+  }
+  return NULL;
+}
+
+bool cbus_dc_coordinator::isPeer(byte canid)
+{
+  return (peer(canid, false) != NULL);
+}
+
+bool cbus_dc_coordinator::consistKnown(byte address)
+{
+  byte page = (address & 0x7f) >> 3;
+  byte bit = 1 << (address & 0x07);
+  if (_local[page] & bit)
+  {
+    return true;
+  }
+  for (byte i = 0; i < COORD_MAX_PEERS; i++)
+  {
+    if ((_peers[i].canid != 0) && (_peers[i].consists[page] & bit))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool cbus_dc_coordinator::consistInUse(byte address)
+{
+  return (_in_use[(address & 0x7f) >> 3] & (1 << (address & 0x07))) != 0;
+}
+
+void cbus_dc_coordinator::setConsistInUse(byte address, bool in_use)
+{
+  byte page = (address & 0x7f) >> 3;
+  byte bit = 1 << (address & 0x07);
+  if (in_use)
+    _in_use[page] |= bit;
+  else
+    _in_use[page] &= ~bit;
+}
+
+void cbus_dc_coordinator::sendState(byte page)
+{
+  page &= (COORD_PAGES - 1);
+  cbus_send<OPC_ACDAT>(highByte(_config->nodeNum), lowByte(_config->nodeNum), COORD_TAG,
+                       (_leader ? COORD_FLAG_LEADER : 0) | (cancmd_present ? 0 : COORD_FLAG_STANDALONE),
+                       page, _local[page], _local[(page + 1) & (COORD_PAGES - 1)]);
+}
+
+void cbus_dc_coordinator::noteFrame(CANFrame *msg)
+{
+  byte canid = msg->id & 0x7f;
+  byte page;
+  t_peer *p;
+  switch (msg->data[0])
+  {
+    case OPC_ACDAT:
+      if ((msg->len < 8) || (msg->data[3] != COORD_TAG))
+      {
+        break;
+      }
+      p = peer(canid, true);
+      if (p == NULL)
+      {
+        break;
+      }
+      page = msg->data[5] & (COORD_PAGES - 1);
+      p->flags = msg->data[4];
+      p->last_seen = millis();
+      p->consists[page] = msg->data[6];
+      p->consists[(page + 1) & (COORD_PAGES - 1)] = msg->data[7];
+      // A lower CAN ID has appeared, so stand down straight away
+      elect();
+      break;
+
+    case OPC_PLOC:
+      // Consist sessions are allocated with a PLOC whose address high byte is zero
+      if ((msg->data[1] & 0x80) && (msg->data[2] == 0))
+      {
+        setConsistInUse(msg->data[3], true);
+      }
+      break;
+
+    case OPC_KLOC:
+      if (msg->data[1] & 0x80)
+      {
+        setConsistInUse(msg->data[1], false);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Consist addresses our controllers are members of
+void cbus_dc_coordinator::updateLocal(void)
+{
+  byte local[COORD_PAGES];
+  byte address;
+  memset(local, 0, sizeof(local));
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    address = controllers.consist[controllerIndex].address & 0x7f;
+    if (address != 0)
+    {
+      local[address >> 3] |= (1 << (address & 0x07));
+    }
+  }
+  for (byte page = 0; page < COORD_PAGES; page++)
+  {
+    if (local[page] != _local[page])
+    {
+      _local[page] = local[page];
+      // Piggyback the change on a state frame now, rather than waiting for its turn
+      sendState(page & ~1);
+    }
+  }
+}
+
+// Lowest live CAN ID leads, once we have listened long enough to know who is there
+void cbus_dc_coordinator::elect(void)
+{
+  if ((millis() - _started) < COORD_SETTLE_MS)
+  {
+    _leader = false;
+    return;
+  }
+  _leader = true;
+  for (byte i = 0; i < COORD_MAX_PEERS; i++)
+  {
+    if ((_peers[i].canid != 0) && (_peers[i].canid < _config->CANID))
+    {
+      _leader = false;
+      return;
+    }
+  }
+}
+
+void cbus_dc_coordinator::update(void)
+{
+  unsigned long now = millis();
+  for (byte i = 0; i < COORD_MAX_PEERS; i++)
+  {
+    if ((_peers[i].canid != 0) && ((now - _peers[i].last_seen) > COORD_TIMEOUT_MS))
+    {
+      _peers[i].canid = 0;
+    }
+  }
+  elect();
+  updateLocal();
+  if ((now - _last_heartbeat) >= COORD_HEARTBEAT_MS)
+  {
+    _last_heartbeat = now;
+    sendState(_next_page);
+    _next_page = (_next_page + 2) & (COORD_PAGES - 1);
+  }
+}
@@ -0,0 +1,84 @@
+//
+//  cbus_dc_coordinator.h
+//
+//  Coordination between several CBUS DC controller modules on one bus.
+//
+//  Consist sessions (consist address with the top bit set) are common to all the DC
+//  controller modules, so only one of them may answer a consist request. Each module
+//  sends a state frame every COORD_HEARTBEAT_MS, as an ACDAT from its node number:
+//    data[3] COORD_TAG, to recognise DC controller modules
+//    data[4] flags
+//    data[5] first page of the consist map carried (8 consist addresses per page)
+//    data[6] consists this module has members of, for that page
+//    data[7] the same for the next page
+//  The pages cycle so that every module learns which consists the others hold,
+//  and a changed page is sent straight away.
+//  The leader is the live module with the lowest CAN ID. A module only claims
+//  leadership once it has listened for COORD_SETTLE_MS, long enough to have heard
+//  every page from every peer, so two modules starting together do not both answer
+//  and a new leader does not refuse a consist that only a peer holds.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_coordinator_h
+#define cbus_dc_coordinator_h
+
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include <CBUSconfig.h>             // module configuration
+#include "cbus_module_defs.h"
+
+const byte COORD_TAG = MODULE_ID;                  // Marks state frames from DC controller modules, the module type
+const byte COORD_MAX_PEERS = 8;                    // Other DC controller modules tracked
+const unsigned long COORD_HEARTBEAT_MS = 1000;
+const unsigned long COORD_TIMEOUT_MS = 3500;       // Peer forgotten after missing this long
+const byte COORD_PAGES = 16;                       // 128 consist addresses, 8 per page
+// Listen this long before leading, a whole cycle of pages from each peer and two heartbeats spare
+const unsigned long COORD_SETTLE_MS = ((COORD_PAGES / 2) + 2) * COORD_HEARTBEAT_MS;
+
+const byte COORD_FLAG_LEADER = 0x01;               // Sender believes it leads
+const byte COORD_FLAG_STANDALONE = 0x02;           // Sender sees no CANCMD
+
+typedef struct
+{
+  byte canid;                                      // 0 if this entry is free
+  byte flags;
+  unsigned long last_seen;
+  byte consists[COORD_PAGES];                      // Consist addresses the peer has members of
+} t_peer;
+
+class cbus_dc_coordinator
+{
+  CBUSConfig *_config;
+  t_peer _peers[COORD_MAX_PEERS];
+  byte _local[COORD_PAGES];                        // Consist addresses we have members of
+  byte _in_use[COORD_PAGES];                       // Consist sessions allocated on the bus
+  byte _next_page;
+  unsigned long _started;
+  unsigned long _last_heartbeat;
+  bool _leader;
+
+  t_peer *peer(byte canid, bool add);
+  void sendState(byte page);
+  void updateLocal(void);
+  void elect(void);
+
+public:
+  cbus_dc_coordinator(void);
+  void begin(CBUSConfig *config);
+  // Called from the frame handler for every frame received
+  void noteFrame(CANFrame *msg);
+  // Called from loop(), sends state frames and ages out peers
+  void update(void);
+  bool isLeader(void) { return _leader; }
+  // True if the frame came from another DC controller module rather than a CANCMD
+  bool isPeer(byte canid);
+  // True if this module or a peer has members of the consist
+  bool consistKnown(byte address);
+  bool consistInUse(byte address);
+  void setConsistInUse(byte address, bool in_use);
+};
+
+#endif
@@ -0,0 +1,191 @@
+//
+//  cbus_dc_event_index.cpp
+//
+//  In RAM index of the learned event table for the CBUS DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <CBUSconfig.h>             // module configuration
+#include <cbusdefs.h>               // MERG CBUS constants
+#include "cbus_dc_event_index.h"
+
+cbus_dc_event_index::cbus_dc_event_index(void)
+{
+  _config = NULL;
+  _entries = NULL;
+  _sorted = NULL;
+  _max_events = 0;
+  _num_evs = 0;
+  _count = 0;
+  _rebuild_pending = false;
+  _update_pending = false;
+  _generation = 0;
+}
+
+// Allocate the index once, sized to the event table, and fill it from EEPROM
+void cbus_dc_event_index::begin(CBUSConfig *config)
+{
+  _config = config;
+  _max_events = config->EE_MAX_EVENTS;
+  _num_evs = min((byte)config->EE_NUM_EVS, EVENT_INDEX_MAX_EVS);
+  _entries = new t_event_entry[_max_events];
+  _sorted = new t_event_key[_max_events];
+  rebuild();
+}
+
+// Read one event table entry from EEPROM into the index
+void cbus_dc_event_index::load(byte index)
+{
+  unsigned int base = _config->EE_EVENTS_START + (index * _config->EE_BYTES_PER_EVENT);
+  unsigned int nn;
+  unsigned int en;
+  t_event_entry *entry = &_entries[index];
+
+  entry->used = (_config->getEvTableEntry(index) != 0);
+  if (!entry->used)
+  {
+    return;
+  }
+  nn = (_config->readEEPROM(base) << 8) | _config->readEEPROM(base + 1);
+  en = (_config->readEEPROM(base + 2) << 8) | _config->readEEPROM(base + 3);
+  entry->key = makeKey(nn, en);
+  for (byte ev = 0; ev < EVENT_INDEX_MAX_EVS; ev++)
+  {
+    entry->evs[ev] = (ev < _num_evs) ? _config->readEEPROM(base + 4 + ev) : 0;
+  }
+}
+
+// First position in the sorted array with a key not less than key
+int cbus_dc_event_index::position(uint32_t key)
+{
+  int low = 0;
+  int high = _count;
+  int mid;
+  while (low < high)
+  {
+    mid = (low + high) / 2;
+    if (_sorted[mid].key < key)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+void cbus_dc_event_index::insert(byte index)
+{
+  int pos = position(_entries[index].key);
+  memmove(&_sorted[pos + 1], &_sorted[pos], (_count - pos) * sizeof(t_event_key));
+  _sorted[pos].key = _entries[index].key;
+  _sorted[pos].index = index;
+  _count++;
+}
+
+void cbus_dc_event_index::remove(byte index)
+{
+  int pos = position(_entries[index].key);
+  // Step over any other entries with the same key
+  while ((pos < _count) && (_sorted[pos].key == _entries[index].key) && (_sorted[pos].index != index))
+  {
+    pos++;
+  }
+  if ((pos < _count) && (_sorted[pos].index == index))
+  {
+    memmove(&_sorted[pos], &_sorted[pos + 1], (_count - pos - 1) * sizeof(t_event_key));
+    _count--;
+  }
+  _entries[index].used = false;
+}
+
+// Mirror the whole event table, at boot or after the node's events are cleared
+void cbus_dc_event_index::rebuild(void)
+{
+  _count = 0;
+  for (byte index = 0; index < _max_events; index++)
+  {
+    load(index);
+    if (_entries[index].used)
+    {
+      insert(index);
+    }
+  }
+  _rebuild_pending = false;
+  _update_pending = false;
+  _generation++;
+}
+
+byte cbus_dc_event_index::find(unsigned int nn, unsigned int en)
+{
+  uint32_t key = makeKey(nn, en);
+  int pos = position(key);
+  if ((pos < _count) && (_sorted[pos].key == key))
+  {
+    return _sorted[pos].index;
+  }
+  return EVENT_INDEX_NONE;
+}
+
+// Spot frames that change the event table.
+// The library acts on them after the frame handler, so the index is brought up to date by refresh().
+void cbus_dc_event_index::noteFrame(CANFrame *msg)
+{
+  unsigned int nn;
+  unsigned int en;
+  switch (msg->data[0])
+  {
+    case OPC_EVLRN:
+    case OPC_EVULN:
+      nn = (msg->data[1] << 8) + msg->data[2];
+      en = (msg->data[3] << 8) + msg->data[4];
+      if (_update_pending && ((nn != _pending_nn) || (en != _pending_en)))
+      {
+        // More than one event changed before refresh, so reload them all
+        _rebuild_pending = true;
+      }
+      _pending_nn = nn;
+      _pending_en = en;
+      _update_pending = true;
+      break;
+
+    case OPC_NNCLR:
+      _rebuild_pending = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+void cbus_dc_event_index::refresh(void)
+{
+  byte old_index;
+  byte new_index;
+  if (_rebuild_pending)
+  {
+    rebuild();
+    return;
+  }
+  if (!_update_pending)
+  {
+    return;
+  }
+  _update_pending = false;
+  old_index = find(_pending_nn, _pending_en);
+  if (old_index != EVENT_INDEX_NONE)
+  {
+    remove(old_index);
+  }
+  new_index = _config->findExistingEvent(_pending_nn, _pending_en);
+  if (new_index < _max_events)
+  {
+    load(new_index);
+    if (_entries[new_index].used)
+    {
+      insert(new_index);
+    }
+  }
+  _generation++;
+}
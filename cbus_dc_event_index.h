@@ -0,0 +1,84 @@
+//
+//  cbus_dc_event_index.h
+//
+//  In RAM index of the learned event table for the CBUS DC controller.
+//
+//  The event table is mirrored from EEPROM once at boot, and then kept up to date
+//  as events are learned and unlearned, so that event handling never reads EEPROM.
+//  EVs are held by event table index, which is what the CBUS library passes to the event handler,
+//  and a second array sorted on NN/EN allows an event to be found by binary search.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_event_index_h
+#define cbus_dc_event_index_h
+
+#include <arduino.h>
+#include <CBUSconfig.h>             // module configuration
+
+const byte EVENT_INDEX_MAX_EVS = 4;   // EVs mirrored for each event
+const byte EVENT_INDEX_NONE = 0xff;   // No event at this index / no event found
+
+typedef struct
+{
+  uint32_t key;                       // NN in the top 16 bits, EN in the bottom 16 bits
+  byte     evs[EVENT_INDEX_MAX_EVS];  // EV1.. for this event
+  bool     used;
+} t_event_entry;
+
+typedef struct
+{
+  uint32_t key;
+  byte     index;                     // Event table index
+} t_event_key;
+
+class cbus_dc_event_index
+{
+  CBUSConfig *_config;
+  t_event_entry *_entries;            // One per event table index
+  t_event_key *_sorted;               // Used entries, sorted on key
+  byte _max_events;
+  byte _num_evs;
+  byte _count;
+  bool _rebuild_pending;
+  bool _update_pending;
+  uint16_t _generation;
+  unsigned int _pending_nn;
+  unsigned int _pending_en;
+
+  void load(byte index);
+  void insert(byte index);
+  void remove(byte index);
+  int position(uint32_t key);
+
+public:
+  cbus_dc_event_index(void);
+  void begin(CBUSConfig *config);
+  void rebuild(void);
+  // Called from the frame handler, before the library has acted on the frame
+  void noteFrame(CANFrame *msg);
+  // Called from loop(), after the library has processed any learn/unlearn frames
+  void refresh(void);
+
+  static uint32_t makeKey(unsigned int nn, unsigned int en) { return ((uint32_t)nn << 16) | en; }
+  // EV value (evnum from 1) for a table index, 0 if not learned
+  byte ev(byte index, byte evnum)
+  {
+    if ((index >= _max_events) || (evnum == 0) || (evnum > EVENT_INDEX_MAX_EVS) || !_entries[index].used)
+      return 0;
+    return _entries[index].evs[evnum - 1];
+  }
+  // Table index of a learned event, EVENT_INDEX_NONE if not learned
+  byte find(unsigned int nn, unsigned int en);
+  byte count(void) { return _count; }
+  // Changes whenever the index does, so users can tell when to rebuild anything derived from it
+  uint16_t generation(void) { return _generation; }
+  byte maxEvents(void) { return _max_events; }
+  // Index of the n'th learned event in NN/EN order
+  byte sortedIndex(byte n) { return _sorted[n].index; }
+  uint32_t sortedKey(byte n) { return _sorted[n].key; }
+};
+
+#endif
@@ -0,0 +1,265 @@
+//
+//  cbus_dc_long_messages.cpp
+//
+//  CBUS long message channel for bulk transfers to and from a PC tool.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include "cbus_module_defs.h"
+#include "cbus_dc_sessions.h"
+#include "speed_curve.h"
+#include "dc_controller.h"
+#include "cbus_dc_long_messages.h"
+
+extern dc_controller Controller;
+
+cbus_dc_long_messages::cbus_dc_long_messages(CBUSbase *cbus)
+#ifdef CBUS_LONG_MESSAGE
+  : _lmsg(cbus)
+#endif
+{
+  _cbus = cbus;
+  _streams[0] = LM_STREAM_CONFIG;
+  _streams[1] = LM_STREAM_TELEMETRY;
+  _rx_len = 0;
+  _rx_overflow = false;
+  _tx_head = 0;
+  _tx_count = 0;
+  _tx_in_flight = false;
+  _rx_messages = 0;
+  _rx_errors = 0;
+  _tx_messages = 0;
+  _tx_refused = 0;
+  _scope_sending = false;
+  _scope_next = 0;
+}
+
+void cbus_dc_long_messages::begin(void (*handler)(byte *fragment, unsigned int fragment_len, byte stream_id, byte status))
+{
+#ifdef CBUS_LONG_MESSAGE
+  _lmsg.subscribe(_streams, LM_NUM_STREAMS, _fragment, LM_FRAGMENT_LEN, handler);
+  _cbus->setLongMessageHandler(&_lmsg);
+#endif
+}
+
+void cbus_dc_long_messages::received(byte *fragment, unsigned int fragment_len, byte stream_id, byte status)
+{
+#ifdef CBUS_LONG_MESSAGE
+  if ((status == CBUS_LONG_MESSAGE_INCOMPLETE) || (status == CBUS_LONG_MESSAGE_COMPLETE))
+  {
+    if ((_rx_len + fragment_len) <= LM_RX_LEN)
+    {
+      memcpy(&_rx[_rx_len], fragment, fragment_len);
+      _rx_len += fragment_len;
+    }
+    else
+    {
+      _rx_overflow = true;
+    }
+    if (status == CBUS_LONG_MESSAGE_INCOMPLETE)
+    {
+      return;
+    }
+    if (_rx_overflow)
+    {
+      _rx_errors++;
+      if (stream_id == LM_STREAM_CONFIG)
+      {
+        reply_error(_rx[0], LM_STATUS_BAD_LENGTH);
+      }
+    }
+    else
+    {
+      _rx_messages++;
+      if ((stream_id == LM_STREAM_CONFIG) && (_rx_len > 0))
+      {
+        command(_rx, _rx_len);
+      }
+    }
+  }
+  else
+  {
+    // Sequence, timeout or CRC error, the message is dropped
+    _rx_errors++;
+  }
+  _rx_len = 0;
+  _rx_overflow = false;
+#endif
+}
+
+bool cbus_dc_long_messages::send(byte stream_id, const void *data, unsigned int len)
+{
+  t_lm_slot *slot;
+  if ((len > LM_TX_LEN) || (_tx_count >= LM_TX_SLOTS))
+  {
+    _tx_refused++;
+    return false;
+  }
+  slot = &_tx[(_tx_head + _tx_count) % LM_TX_SLOTS];
+  slot->stream_id = stream_id;
+  slot->len = len;
+  memcpy(slot->data, data, len);
+  _tx_count++;
+  return true;
+}
+
+void cbus_dc_long_messages::process(void)
+{
+#ifdef CBUS_LONG_MESSAGE
+  t_lm_slot *slot;
+  if (_scope_sending)
+  {
+    send_scope();
+  }
+  _lmsg.process();
+  if (_lmsg.is_sending())
+  {
+    return;
+  }
+  // The library has finished with the slot it was sending from
+  if (_tx_in_flight)
+  {
+    _tx_in_flight = false;
+    _tx_head = (_tx_head + 1) % LM_TX_SLOTS;
+    _tx_count--;
+    _tx_messages++;
+  }
+  if (_tx_count > 0)
+  {
+    slot = &_tx[_tx_head];
+    _tx_in_flight = _lmsg.sendLongMessage(slot->data, slot->len, slot->stream_id);
+  }
+#endif
+}
+
+void cbus_dc_long_messages::reply_error(byte cmd, byte status)
+{
+  byte reply[3] = { LM_REPLY_ERROR, cmd, status };
+  send(LM_STREAM_CONFIG, reply, sizeof(reply));
+}
+
+void cbus_dc_long_messages::command(const byte *msg, unsigned int len)
+{
+  byte reply[2 + (SPEED_CURVE_STEPS * 2)];
+  byte controllerIndex;
+  uint16_t level;
+  if (scope_command(msg, len))
+  {
+    return;
+  }
+  if (len < 2)
+  {
+    reply_error(msg[0], LM_STATUS_BAD_LENGTH);
+    return;
+  }
+  controllerIndex = msg[1];
+  if (controllerIndex >= NUM_CONTROLLERS)
+  {
+    reply_error(msg[0], LM_STATUS_BAD_CONTROLLER);
+    return;
+  }
+  reply[0] = msg[0] | LM_REPLY;
+  reply[1] = controllerIndex;
+  switch (msg[0])
+  {
+    case LM_CMD_GET_SPEED_TABLE:
+      for (byte step = 0; step < SPEED_CURVE_STEPS; step++)
+      {
+        level = controllers.trainController[controllerIndex].getSpeedLevel(step);
+        reply[2 + (step * 2)] = lowByte(level);
+        reply[3 + (step * 2)] = highByte(level);
+      }
+      send(LM_STREAM_CONFIG, reply, sizeof(reply));
+      break;
+
+    case LM_CMD_SET_SPEED_TABLE:
+      if (len != (2 + SPEED_TABLE_POINTS))
+      {
+        reply_error(msg[0], LM_STATUS_BAD_LENGTH);
+        return;
+      }
+      controllers.trainController[controllerIndex].setSpeedTable(&msg[2]);
+      reply[2] = LM_STATUS_OK;
+      send(LM_STREAM_CONFIG, reply, 3);
+      break;
+
+    default:
+      reply_error(msg[0], LM_STATUS_UNKNOWN_COMMAND);
+      break;
+  }
+}
+
+// Scope commands are not for a controller, so are handled before the speed table commands
+bool cbus_dc_long_messages::scope_command(const byte *msg, unsigned int len)
+{
+  byte reply[2];
+  reply[0] = msg[0] | LM_REPLY;
+  switch (msg[0])
+  {
+    case LM_CMD_SCOPE_ARM:
+      if (len != 4)
+      {
+        reply_error(msg[0], LM_STATUS_BAD_LENGTH);
+        return true;
+      }
+      _scope_sending = false;
+      Controller.scope().arm((t_scope_trigger)msg[1], msg[2] | (msg[3] << 8));
+      reply[1] = LM_STATUS_OK;
+      send(LM_STREAM_CONFIG, reply, sizeof(reply));
+      return true;
+
+    case LM_CMD_SCOPE_READ:
+      if (!Controller.scope().done())
+      {
+        reply_error(msg[0], LM_STATUS_NOT_READY);
+        return true;
+      }
+      reply[1] = LM_STATUS_OK;
+      send(LM_STREAM_CONFIG, reply, sizeof(reply));
+      _scope_sending = true;
+      _scope_next = 0;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Send the next chunk of the capture, if there is a slot for it
+void cbus_dc_long_messages::send_scope(void)
+{
+  t_scope_sample samples[LM_SCOPE_CHUNK];
+  byte chunk[4 + (LM_SCOPE_CHUNK * LM_SCOPE_SAMPLE_LEN)];
+  byte *p = &chunk[4];
+  unsigned int count;
+  if (!sendReady())
+  {
+    return;
+  }
+  count = Controller.scope().read(_scope_next, samples, LM_SCOPE_CHUNK);
+  chunk[0] = LM_TELEMETRY_SCOPE;
+  chunk[1] = lowByte(_scope_next);
+  chunk[2] = highByte(_scope_next);
+  chunk[3] = count;
+  for (unsigned int i = 0; i < count; i++)
+  {
+    *p++ = samples[i].phase;
+    *p++ = samples[i].output;
+    *p++ = samples[i].flags;
+    *p++ = lowByte(samples[i].bemf);
+    *p++ = highByte(samples[i].bemf);
+    *p++ = lowByte(samples[i].requested);
+    *p++ = highByte(samples[i].requested);
+  }
+  send(LM_STREAM_TELEMETRY, chunk, p - chunk);
+  _scope_next += count;
+  // A short (or empty) chunk marks the end of the capture
+  if (count < LM_SCOPE_CHUNK)
+  {
+    _scope_sending = false;
+  }
+}
@@ -0,0 +1,117 @@
+//
+//  cbus_dc_long_messages.h
+//
+//  CBUS long message channel for bulk transfers to and from a PC tool.
+//
+//  Fragments from the library are reassembled into a preallocated buffer, and a
+//  message is only acted on once it is complete. The library checks the CRC of each
+//  complete message, and messages that fail it (or arrive out of sequence or too late)
+//  are dropped and counted.
+//  Outgoing messages are copied into one of LM_TX_SLOTS preallocated slots and sent
+//  in turn. A slot is only reused once the library has finished sending it, and
+//  send() returns false when all the slots are full, so callers can hold off.
+//
+//  Messages on LM_STREAM_CONFIG start with a command byte, and the reply has the
+//  top bit of the command set:
+//    LM_CMD_GET_SPEED_TABLE  controller             -> controller, 128 levels (16 bit, low byte first)
+//    LM_CMD_SET_SPEED_TABLE  controller, 28 points  -> controller, status
+//    LM_CMD_SCOPE_ARM        trigger, threshold (16 bit) -> status
+//    LM_CMD_SCOPE_READ                              -> status, then the capture on LM_STREAM_TELEMETRY
+//  A command that cannot be carried out gets LM_REPLY_ERROR, command, status.
+//  LM_STREAM_TELEMETRY carries traces and counters from the module. A scope capture
+//  is sent as LM_TELEMETRY_SCOPE, first sample (16 bit), count, then count samples of
+//  LM_SCOPE_SAMPLE_LEN bytes: phase, output, flags, BEMF (16 bit), requested (16 bit).
+//  All 16 bit values are low byte first.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_long_messages_h
+#define cbus_dc_long_messages_h
+
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include "cbus_module_defs.h"
+
+const byte LM_STREAM_CONFIG = 0xD0;          // Commands from the PC tool, and replies
+const byte LM_STREAM_TELEMETRY = 0xD1;       // Traces and counters from the module
+const byte LM_NUM_STREAMS = 2;
+
+const unsigned int LM_FRAGMENT_LEN = 64;     // Library receive buffer, delivered as fragments
+const unsigned int LM_RX_LEN = 64;           // Largest message received
+const unsigned int LM_TX_LEN = 260;          // Largest message sent
+const byte LM_TX_SLOTS = 4;
+
+const byte LM_CMD_GET_SPEED_TABLE = 0x01;
+const byte LM_CMD_SET_SPEED_TABLE = 0x02;
+const byte LM_CMD_SCOPE_ARM = 0x03;
+const byte LM_CMD_SCOPE_READ = 0x04;
+const byte LM_REPLY = 0x80;                  // Set in the command byte of a reply
+const byte LM_REPLY_ERROR = 0xFF;
+
+const byte LM_STATUS_OK = 0;
+const byte LM_STATUS_BAD_LENGTH = 1;
+const byte LM_STATUS_BAD_CONTROLLER = 2;
+const byte LM_STATUS_UNKNOWN_COMMAND = 3;
+const byte LM_STATUS_NOT_READY = 4;
+
+const byte LM_TELEMETRY_SCOPE = 0x01;
+const byte LM_SCOPE_SAMPLE_LEN = 7;
+const byte LM_SCOPE_CHUNK = (LM_TX_LEN - 4) / LM_SCOPE_SAMPLE_LEN;
+
+typedef struct
+{
+  byte stream_id;
+  unsigned int len;
+  byte data[LM_TX_LEN];
+} t_lm_slot;
+
+class cbus_dc_long_messages
+{
+  CBUSbase *_cbus;
+#ifdef CBUS_LONG_MESSAGE
+  CBUSLongMessage _lmsg;
+#endif
+  byte _streams[LM_NUM_STREAMS];
+  byte _fragment[LM_FRAGMENT_LEN];
+  // Reassembly of the message being received
+  byte _rx[LM_RX_LEN];
+  unsigned int _rx_len;
+  bool _rx_overflow;
+  // Messages waiting to be sent, oldest at _tx_head
+  t_lm_slot _tx[LM_TX_SLOTS];
+  byte _tx_head;
+  byte _tx_count;
+  bool _tx_in_flight;
+  // Counters
+  unsigned long _rx_messages;
+  unsigned long _rx_errors;
+  unsigned long _tx_messages;
+  unsigned long _tx_refused;
+  // Scope capture being sent, one chunk at a time as slots come free
+  bool _scope_sending;
+  unsigned int _scope_next;
+
+  void command(const byte *msg, unsigned int len);
+  void reply_error(byte cmd, byte status);
+  bool scope_command(const byte *msg, unsigned int len);
+  void send_scope(void);
+
+public:
+  cbus_dc_long_messages(CBUSbase *cbus);
+  void begin(void (*handler)(byte *fragment, unsigned int fragment_len, byte stream_id, byte status));
+  // Called from the long message handler with each fragment
+  void received(byte *fragment, unsigned int fragment_len, byte stream_id, byte status);
+  // Queue a message, false if there is no room for it yet
+  bool send(byte stream_id, const void *data, unsigned int len);
+  bool sendReady(void) { return (_tx_count < LM_TX_SLOTS); }
+  // Called from loop()
+  void process(void);
+  unsigned long rxMessages(void) { return _rx_messages; }
+  unsigned long rxErrors(void) { return _rx_errors; }
+  unsigned long txMessages(void) { return _tx_messages; }
+  unsigned long txRefused(void) { return _tx_refused; }
+};
+
+#endif
@@ -16,12 +16,17 @@
 #include "dc_controller_defs.h"
 #include "cbus_dc_sessions.h"        // CBUS message functions
 #include "cbus_dc_messages.h"        // CBUS message functions
+#include "cbus_frame.h"
 #include "dc_controller.h"
 #include "throttle.h"
+#include "cbus_dc_event_index.h"
+#include "cbus_dc_actions.h"
+#include "cbus_dc_long_messages.h"
 
-CBUSConfig _mod_config;
-CBUSESP32 _cbus; // CBUS Object
 cbus_dc_sessions _sesssions;
+extern cbus_dc_event_index EventIndex;
+extern cbus_dc_actions Actions;
+extern cbus_dc_long_messages LongMessages;
 
 //bool cancmd_present = false;
 //volatile byte timer_counter = 0;
@@ -38,90 +43,31 @@ cbus_dc_messages::cbus_dc_messages()
 
 void cbus_dc_messages::messages_setup(CBUSConfig params, CBUSESP32 cbus_params)
 {
-  _mod_config = params;
-  _cbus = cbus_params; 
-}
-
-
-/// Send an event routine built to start sending events based on input from a CANCAB
-bool sendEvent(byte opCode,unsigned int eventNo)
-{
-    CANFrame msg;
-    msg.id = _mod_config.CANID;
-    msg.len = 5;
-    msg.data[0] = opCode;
-    msg.data[1] = highByte(_mod_config.nodeNum);
-    msg.data[2] = lowByte(_mod_config.nodeNum);
-    msg.data[3] = highByte(eventNo); // event number (EN) could be > 255
-    msg.data[4] = lowByte(eventNo); //CBUSConfig
-    msg.ext = false;
-    msg.rtr = false;
-
-    //bool res = CBUS.sendMessage(&msg);
-    bool res = _cbus.sendMessage(&msg);
-#if DEBUG
-    if (res) {
-      Serial << F("> sent CBUS event with opCode [ 0x") << _HEX(opCode) << F(" ] and event No ") << eventNo << endl;
-    } else {
-      Serial << F("> error sending CBUS event wit opcode [ 0x") <<  _HEX(opCode) << F(" ]") << endl;
-    }
-#endif
-    return res;
+  // Frames are sent on the sketch's CBUS object with its configuration, see cbus_frame.h
+  ;
 }
 
 
-/// Send an event routine built to start sending events based with one extra byte
-/// The events can be ACON1 or ACOF1 with 1 byte of data.
-bool sendEvent1(byte opCode, unsigned int eventNo, byte item)
-{
-    CANFrame msg;
-    msg.id = _mod_config.CANID;
-    msg.len = 6;
-    msg.data[0] = opCode;
-    msg.data[1] = highByte(_mod_config.nodeNum);
-    msg.data[2] = lowByte(_mod_config.nodeNum);
-    msg.data[3] = highByte(eventNo); // event number (EN) could be > 255
-    msg.data[4] = lowByte(eventNo); 
-    msg.data[5] = item;    // The extra byte
-    msg.ext = false;
-    msg.rtr = false;
-
-    bool res = _cbus.sendMessage(&msg);
-#if DEBUG
-    if (res) {
-      Serial << F("> sent CBUS event with opCode [ 0x") << _HEX(opCode) << F(" ] and event No ") << eventNo << endl;
-    } else {
-      Serial << F("> error sending CBUS event wit opcode [ 0x") <<  _HEX(opCode) << F(" ]") << endl;
-    }
-#endif
-    return res;
-}
-
 /// Send an event routine built to start sending events based with extra bytes
 bool sendEventN(byte opCode,unsigned int eventNo, byte n, const byte* buf)
 {
-  // The events can be ACON1, ACOF1, ACON2, ACOF2, ACON3, ACOF3 with 1 2 or 3 bytes of data.
-  // I am not checking the match between opcode and data length (as yet)
-  if (n == 0) {
-     // no data, use the old method.
-     return sendEvent(opCode, eventNo);
-  } else {
-    CANFrame msg;
-    msg.id = _mod_config.CANID;
-    msg.len = 5+n;
-    msg.data[0] = opCode;
-    msg.data[1] = highByte(_mod_config.nodeNum);
-    msg.data[2] = lowByte(_mod_config.nodeNum);
-    msg.data[3] = highByte(eventNo); // event number (EN) could be > 255
-    msg.data[4] = lowByte(eventNo); 
-    for(byte i = 0;  i< n; i++)
+  // The events can be ACON, ACOF, ACON1, ACOF1, ACON2, ACOF2, ACON3, ACOF3 with 0 to 3 bytes of data.
+  // cbus_send_frame refuses the frame if the opcode does not match the data length.
+  byte frame[CBUS_FRAME_MAX_LEN];
+  bool res = false;
+  if (n <= (sizeof(frame) - 5))
+  {
+    frame[0] = opCode;
+    frame[1] = highByte(config.nodeNum);
+    frame[2] = lowByte(config.nodeNum);
+    frame[3] = highByte(eventNo); // event number (EN) could be > 255
+    frame[4] = lowByte(eventNo);
+    if (n > 0)
     {
-       msg.data[i+5] = buf[i];
+      memcpy(&frame[5], buf, n);
     }
-    msg.ext = false;
-    msg.rtr = false;
-
-    bool res = _cbus.sendMessage(&msg);
+    res = cbus_send_frame(5 + n, frame);
+  }
 #if DEBUG
     if (res) {
       Serial << F("> sent CBUS event with opCode [ 0x") << _HEX(opCode) << F(" ] and event No ") << eventNo << endl;
@@ -133,25 +79,45 @@ bool sendEventN(byte opCode,unsigned int eventNo, byte n, const byte* buf)
     }
 #endif
     return res;
-  }
+}
+
+/// Send an event routine built to start sending events based on input from a CANCAB
+bool sendEvent(byte opCode,unsigned int eventNo)
+{
+    return sendEventN(opCode, eventNo, 0, NULL);
 }
 
 
-/// This replaces the CAN0.SendMsgBuff usage.
+/// Send an event routine built to start sending events based with one extra byte
+/// The events can be ACON1 or ACOF1 with 1 byte of data.
+bool sendEvent1(byte opCode, unsigned int eventNo, byte item)
+{
+    return sendEventN(opCode, eventNo, 1, &item);
+}
+
+/// Send a frame whose opcode is only known at run time.
 /// It uses the CANID of the current configuration.
-bool cbus_dc_messages::sendMessage(byte len, const byte *buf)
+bool cbus_send_frame(byte len, const byte *buf)
 {
     CANFrame msg;
-    msg.id = _mod_config.CANID;
-    msg.len = len;
-    for(byte i = 0;  i< len; i++)
+    if ((len == 0) || (len > CBUS_FRAME_MAX_LEN) || (len != cbus_opc_len(buf[0])))
     {
-       msg.data[i] = buf[i];
+#if DEBUG
+      Serial << F("> CBUS message length ") << len << F(" does not match opcode") << endl;
+#endif
+      return false;
     }
+    msg.id = config.CANID;
+    msg.len = len;
+    memcpy(msg.data, buf, len);
     msg.ext = false;
     msg.rtr = false;
   
-    bool res = _cbus.sendMessage(&msg);
+    bool res = CBUS.sendMessage(&msg);
+    if (!res)
+    {
+      Metrics.txFailed();
+    }
 #if DEBUG
     if (res) {
       Serial << F("> sent CBUS message with code [ 0x") << _HEX(buf[0]) << F(" ] and size ") << len << endl;
@@ -170,6 +136,13 @@ bool cbus_dc_messages::sendMessage(byte len, const byte *buf)
     return res;
  }
 
+/// This replaces the CAN0.SendMsgBuff usage.
+/// It uses the CANID of the current configuration.
+bool cbus_dc_messages::sendMessage(byte len, const byte *buf)
+{
+    return cbus_send_frame(len, buf);
+}
+
 //
 /// user-defined event processing function
 /// called from the CBUS library when a learned event is received
@@ -178,137 +151,33 @@ bool cbus_dc_messages::sendMessage(byte len, const byte *buf)
 
 void cbus_dc_messages::eventhandler(byte index, CANFrame *msg) 
 {
-
-  // as an example, control an LED if the first EV equals 1
-
-  Serial << F("> event handler: index = ") << index << F(", opcode = 0x") << _HEX(msg->data[0]) << endl;
-
 /* 
- *  I am going to change the event handler to process based on the opcode as is done in the
- *  message handler. The old alternative is now removed.
+ *  Learned events are turned into controller actions by the action engine.
+ *  The EVs were compiled into its table when the event was learned, so nothing
+ *  is looked up or interpreted here.
  */
     byte op_code = msg->data[0];
+#if DEBUG
     unsigned int node_number = (msg->data[1] << 8 ) + msg->data[2];
     // This is not true in all cases.
     // For some it is the device number
     unsigned int event_number = (msg->data[3] << 8 ) + msg->data[4];
-    // For now get the first event value
-    byte ev = 1;
-    //byte evval = config.getEventEVval(index, ev - 1); I think the library has changed.
-    byte evval = _mod_config.getEventEVval(index, ev);
+    Serial << F("> event handler: index = ") << index << F(", opcode = 0x") << _HEX(op_code) << endl;
     Serial << F("> NN = ") << node_number << F(", EN = ") << event_number << endl;
-    Serial << F("> op_code = ") << op_code << endl;
-    Serial << F("> EV1 = ") << evval << endl;
-    switch (op_code)
-    {
-         // Event on and off
-         // Handle these together based on event no.
-         case OPC_ACON:
-         case OPC_ACOF:
-         if (evval == 1) {
-            if (op_code == OPC_ACON) {
-               Serial << F("> switching the LED on") << endl;
-               //moduleLED.blink();
-            } else if (op_code == OPC_ACOF) {
-               Serial << F("> switching the LED off") << endl;
-               //moduleLED.off();
-            }
-         }
-
-         // This is my buzzer example changed to use op codes and test off as well as on.
-         // Now changed to use the CBUSBUZZER library
-         if (evval == 99) { //Corrected bug 
-            if ( op_code == OPC_ACON) {
-               Serial << F("> switching the LED on") << endl;
-               //moduleLED.blink();
-#if USE_CBUSBUZZER
-               moduleBuzzer.on();
-#else
-               //tone(buzzer, 1000);
+    Serial << F("> EV1 = ") << EventIndex.ev(index, EV_ACTION_ON) << F(", EV2 = ") << EventIndex.ev(index, EV_ACTION_OFF) << endl;
 #endif
-               Serial << F("> BUZZER ON") << endl;
-            } else if ( op_code == OPC_ACOF){
-               Serial << F("> switching the LED off") << endl;
-               //moduleLED.off();
-#if USE_CBUSBUZZER
-               moduleBuzzer.off();
-#else
-               //noTone(buzzer);
-#endif
-               Serial << F("> BUZZER OFF") << endl;
-               }
-         }
-
-         break;
-#if ACCESSORY_REQUEST_EVENT 
-         // Accessory response events
-         // Handle these together based on event no.
-         case OPC_ARON:
-         case OPC_AROF:
-            Serial << F("> Handling long event response to remote request ");
-            if ( op_code == OPC_ARON) {
-               Serial << F(" : remote event is on") << endl;            
-            } else if (op_code == OPC_AROF) {
-               Serial << F(" : remote event is off") << endl;            
-            }
-         break;
-#if USE_SHORT_EVENTS
-         // Accessory response short events
-         // Handle these together based on event no.
-         case OPC_ARSON:
-         case OPC_ARSOF:
-            Serial << F("> Handling short event response to remote request ");
-            Serial << F(" device number ") << event_number;
-            if ( op_code == OPC_ARSON) {
-               Serial << F(" : remote event is on") << endl;            
-            } else if (op_code == OPC_ARSOF) {
-               Serial << F(" : remote event is off") << endl;            
-            }
-         break;
-#endif
-#endif
-         // Space for more op codes.
-         default:
-         // ignore any other CBUS events
-#if DEBUG
-         //Serial << F("Event ignored with Opcode [ 0x") << _HEX(op_code) << F(" ]")<< endl;
-#endif
-         break;
-    }
-  
+    Actions.dispatch(index, op_code);
 
   return;
 }
 
 #ifdef CBUS_LONG_MESSAGE
-   byte new_message = true;
 ///
 /// Handler to receive a long message 
 ///
 void cbus_dc_messages::longmessagehandler(byte *fragment, unsigned int fragment_len, byte stream_id, byte status){
-// I need an example for what goes in here.
-     fragment[fragment_len] = 0;
-// If the message is complete it will be in fragment and I can do something with it.
-     if( new_message) { // Print this only for the start of a message.
-        Serial << F("> user long message handler: stream = ") << stream_id << F(", fragment length = ") 
-               << fragment_len << F(", fragment = |");
-        new_message = false;
-     }
-     if ( status == CBUS_LONG_MESSAGE_INCOMPLETE ) {
-     // handle incomplete message
-         Serial.write(fragment, fragment_len);
-    } else if (status == CBUS_LONG_MESSAGE_COMPLETE) {
-     // handle complete message
-        Serial.write(fragment, fragment_len);
-        Serial << F("|, status = ") << status << endl;
-        new_message = true;  // reset for the next message
-     } else {  // CBUS_LONG_MESSAGE_SEQUENCE_ERROR
-               // CBUS_LONG_MESSAGE_TIMEOUT_ERROR,
-               // CBUS_LONG_MESSAGE_CRC_ERROR
-               // raise an error?
-        Serial << F("| Message error with  status = ") << status << endl;
-        new_message = true;  // reset for the next message
-     } 
+  // Fragments are reassembled, checked and acted on by the long message channel
+  LongMessages.received(fragment, fragment_len, stream_id, status);
 }
   
 #endif
@@ -0,0 +1,131 @@
+//
+//  cbus_dc_metrics.cpp
+//
+//  Runtime counters for the CBUS DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include <CBUSconfig.h>             // module configuration
+#include <cbusdefs.h>               // MERG CBUS constants
+#include "dc_controller.h"
+#include "cbus_frame.h"
+#include "cbus_dc_metrics.h"
+
+extern dc_controller Controller;
+
+static const char *metric_names[METRIC_COUNT] =
+{
+  "frames received",
+  "TX failed",
+  "session timeouts",
+  "ESTOPs",
+  "tick overruns",
+  "BEMF min",
+  "BEMF max",
+};
+
+cbus_dc_metrics::cbus_dc_metrics(void)
+{
+  _config = NULL;
+  _nv_latch = 0;
+  reset();
+}
+
+void cbus_dc_metrics::begin(CBUSConfig *config)
+{
+  _config = config;
+}
+
+uint32_t cbus_dc_metrics::value(t_metric metric)
+{
+  switch (metric)
+  {
+    case METRIC_FRAMES_RECEIVED:
+      return _frames_received.load(std::memory_order_relaxed);
+    case METRIC_TX_FAILED:
+      return _tx_failed.load(std::memory_order_relaxed);
+    case METRIC_SESSION_TIMEOUTS:
+      return _session_timeouts.load(std::memory_order_relaxed);
+    case METRIC_ESTOPS:
+      return _estops.load(std::memory_order_relaxed);
+    case METRIC_TICK_OVERRUNS:
+      return Controller.tick_overruns();
+    case METRIC_BEMF_MIN:
+      // No reading yet
+      return (Controller.bemf_min() > Controller.bemf_max()) ? 0 : Controller.bemf_min();
+    case METRIC_BEMF_MAX:
+      return Controller.bemf_max();
+    default:
+      return 0;
+  }
+}
+
+void cbus_dc_metrics::reset(void)
+{
+  for (unsigned int opc = 0; opc < 256; opc++)
+  {
+    _frames[opc].store(0, std::memory_order_relaxed);
+  }
+  _frames_received.store(0, std::memory_order_relaxed);
+  _tx_failed.store(0, std::memory_order_relaxed);
+  _session_timeouts.store(0, std::memory_order_relaxed);
+  _estops.store(0, std::memory_order_relaxed);
+}
+
+void cbus_dc_metrics::print(Print &out)
+{
+  uint32_t count;
+  out.println(F("> runtime metrics"));
+  for (byte metric = 0; metric < METRIC_COUNT; metric++)
+  {
+    out.print(F("  "));
+    out.print(metric_names[metric]);
+    out.print(F(" = "));
+    out.println(value((t_metric)metric));
+  }
+  out.println(F("  frames by opcode"));
+  for (unsigned int opc = 0; opc < 256; opc++)
+  {
+    count = frames(opc);
+    if (count != 0)
+    {
+      out.print(F("    0x"));
+      if (opc < 0x10)
+      {
+        out.print('0');
+      }
+      out.print(opc, HEX);
+      out.print(F(" = "));
+      out.println(count);
+    }
+  }
+}
+
+void cbus_dc_metrics::noteFrame(CANFrame *msg)
+{
+  byte nv;
+  byte index;
+  byte shift;
+  if ((_config == NULL) || (msg->len < 4) || (msg->data[0] != OPC_NVRD))
+  {
+    return;
+  }
+  if ((((msg->data[1] << 8) | msg->data[2]) != _config->nodeNum) ||
+      (msg->data[3] < METRICS_NV_BASE) ||
+      (msg->data[3] >= METRICS_NV_BASE + (METRIC_COUNT * METRICS_NV_PER_METRIC)))
+  {
+    return;
+  }
+  nv = msg->data[3];
+  index = nv - METRICS_NV_BASE;
+  if ((index % METRICS_NV_PER_METRIC) == 0)
+  {
+    _nv_latch = value((t_metric)(index / METRICS_NV_PER_METRIC));
+  }
+  shift = 8 * (METRICS_NV_PER_METRIC - 1 - (index % METRICS_NV_PER_METRIC));
+  cbus_send<OPC_NVANS>(highByte(_config->nodeNum), lowByte(_config->nodeNum), nv, (byte)(_nv_latch >> shift));
+}
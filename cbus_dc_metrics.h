@@ -0,0 +1,77 @@
+//
+//  cbus_dc_metrics.h
+//
+//  Runtime counters for the CBUS DC controller.
+//
+//  Counters are atomics updated with relaxed ordering, so they can be bumped from the
+//  CAN receive path and read from the serial interpreter without locking. Counters
+//  written from different places are kept on separate cache lines. The per-opcode frame
+//  counts share lines with each other, as a line each would cost 8k of RAM.
+//  The waveform counters live in the dc_controller, which is copied at start up and so
+//  cannot hold atomics, and are read from there.
+//
+//  The counters can be printed on the serial port, or read with NVRD as virtual node
+//  variables above the real ones. Each counter takes METRICS_NV_PER_METRIC NVs, most
+//  significant byte first, and reading the first one latches the counter so that the
+//  other bytes belong to the same value. The library also answers an NVRD above
+//  EE_NUM_NVS with a CMDERR, which the tool should ignore for these NVs.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_metrics_h
+#define cbus_dc_metrics_h
+
+#include <arduino.h>
+#include <atomic>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include <CBUSconfig.h>             // module configuration
+
+const unsigned int METRICS_CACHE_LINE = 32;
+const byte METRICS_NV_BASE = 101;            // First virtual NV
+const byte METRICS_NV_PER_METRIC = 4;
+
+typedef enum
+{
+  METRIC_FRAMES_RECEIVED,
+  METRIC_TX_FAILED,
+  METRIC_SESSION_TIMEOUTS,
+  METRIC_ESTOPS,
+  METRIC_TICK_OVERRUNS,
+  METRIC_BEMF_MIN,
+  METRIC_BEMF_MAX,
+  METRIC_COUNT,
+} t_metric;
+
+class cbus_dc_metrics
+{
+  alignas(METRICS_CACHE_LINE) std::atomic<uint32_t> _frames[256];   // Frames received, by opcode
+  alignas(METRICS_CACHE_LINE) std::atomic<uint32_t> _frames_received;
+  alignas(METRICS_CACHE_LINE) std::atomic<uint32_t> _tx_failed;
+  alignas(METRICS_CACHE_LINE) std::atomic<uint32_t> _session_timeouts;
+  alignas(METRICS_CACHE_LINE) std::atomic<uint32_t> _estops;
+  CBUSConfig *_config;
+  uint32_t _nv_latch;
+
+public:
+  cbus_dc_metrics(void);
+  void begin(CBUSConfig *config);
+  void frameReceived(byte opc)
+  {
+    _frames[opc].fetch_add(1, std::memory_order_relaxed);
+    _frames_received.fetch_add(1, std::memory_order_relaxed);
+  }
+  void txFailed(void) { _tx_failed.fetch_add(1, std::memory_order_relaxed); }
+  void sessionTimeout(void) { _session_timeouts.fetch_add(1, std::memory_order_relaxed); }
+  void estop(void) { _estops.fetch_add(1, std::memory_order_relaxed); }
+  uint32_t value(t_metric metric);
+  uint32_t frames(byte opc) { return _frames[opc].load(std::memory_order_relaxed); }
+  void reset(void);
+  // Counters and the non-zero opcode counts, for the serial interpreter
+  void print(Print &out);
+  // Called from the frame handler, answers an NVRD for a virtual NV
+  void noteFrame(CANFrame *msg);
+};
+
+#endif
@@ -1,12 +1,59 @@
+//
+//  cbus_dc_serial_interpreter.cpp
+//
+//  Serial command shell for the CBUS DC controller.
+//
+//  processSerialInput() is called on every pass of loop() and never waits. Characters
+//  are gathered into a line, and a complete line is run as one or more commands
+//  separated by ';', one command per pass. 'wait <ms>' holds the rest of the line
+//  back without blocking, so a line such as
+//      speed 0 40 f; wait 2000; scope dir; speed 0 40 r; wait 1000; scope dump
+//  can drive a test over serial while the waveform keeps running.
+//  Long listings (events, NVs, the scope dump) are printed a row at a time, and only
+//  when the serial transmit buffer has room, so they never hold up the loop.
+//  The original single letter commands are still accepted as a line on their own.
+//
 #include "cbus_dc_serial_interpreter.h"
 #include "arduino.h"
 #include "cbus_dc_messages.h"
-
-CBUSConfig m_config;
-
-void cbus_serial_setup(CBUSConfig params)
+#include "cbus_dc_event_index.h"
+#include "cbus_dc_metrics.h"
+#include "task_scheduler.h"
+#include "motor_profile.h"
+
+CBUSConfig *m_config;
+extern cbus_dc_event_index EventIndex;
+extern cbus_dc_sessions SessionMngr;
+extern dc_controller Controller;
+extern cbus_dc_metrics Metrics;
+extern task_scheduler Scheduler;
+extern motor_profiles MotorProfiles;
+
+const byte SERIAL_LINE_LEN = 96;
+const byte SERIAL_ROW_SPACE = 96;        // Transmit buffer space needed to print a row
+const byte SERIAL_CHARS_PER_PASS = 32;
+
+typedef enum
+{
+  LISTING_NONE,
+  LISTING_EVENTS,
+  LISTING_NVS,
+  LISTING_SCOPE,
+} t_listing;
+
+static char line[SERIAL_LINE_LEN];       // Line being typed
+static byte line_len = 0;
+static char script[SERIAL_LINE_LEN];     // Line being run
+static char *script_next = NULL;         // Next command in it, NULL when done
+static bool waiting = false;
+static unsigned long wait_start;
+static unsigned long wait_ms;
+static t_listing listing = LISTING_NONE;
+static unsigned int listing_row;
+
+void cbus_serial_setup(CBUSConfig *config)
 {
-  m_config = params;
+  m_config = config;
 }
 
 
@@ -36,7 +83,7 @@ void printConfig(void) {
   byte controllerIndex;
   for (controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
-    Serial << F("> Controller ") << controllerIndex << F(" is ") << controllers[controllerIndex].DCCAddress << endl;
+    Serial << F("> Controller ") << controllerIndex << F(" is ") << controllers.DCCAddress[controllerIndex] << endl;
   }
   #if OLED_DISPLAY || LCD_DISPLAY
     #if OLED_DISPLAY
@@ -62,160 +109,537 @@ void printConfig(void) {
   return;
 }
 
-void processSerialInput(void) {
-
-  byte uev = 0;
-  char msgstr[32], dstr[32];
-
-  if (Serial.available()) {
-
-    char c = Serial.read();
-
-    switch (c) {
-
-      case 'n':
-
-        // node config
-        printConfig();
-
-        // node identity
-        Serial << F("> CBUS node configuration") << endl;
-        Serial << F("> mode = ") << (m_config.FLiM ? "FLiM" : "SLiM") << F(", CANID = ") << m_config.CANID << F(", node number = ") << m_config.nodeNum << endl;
+// One row of a long listing, false once it is finished
+static bool listing_row_print(void)
+{
+  char row[80];
+  byte index;
+  uint32_t key;
+  switch (listing)
+  {
+    case LISTING_EVENTS:
+      if (listing_row >= EventIndex.count())
+      {
         Serial << endl;
-        break;
-
-      case 'e':
-
-        // EEPROM learned event data table
-        Serial << F("> stored events ") << endl;
+        return false;
+      }
+      // in NN/EN order, from the RAM event index
+      index = EventIndex.sortedIndex(listing_row);
+      key = EventIndex.sortedKey(listing_row);
+      snprintf(row, sizeof(row), "  %03d  |  0x%02x |  0x%02x |  0x%02x |  0x%02x | ", index,
+               (byte)(key >> 24), (byte)(key >> 16), (byte)(key >> 8), (byte)key);
+      Serial << row;
+      for (byte e = 1; e <= m_config->EE_NUM_EVS; e++)
+      {
+        snprintf(row, sizeof(row), " 0x%02x | ", EventIndex.ev(index, e));
+        Serial << row;
+      }
+      snprintf(row, sizeof(row), "%4d |", m_config->getEvTableEntry(index));
+      Serial << row << endl;
+      break;
+
+    case LISTING_NVS:
+      // note NVs number from 1, not 0
+      if (listing_row >= m_config->EE_NUM_NVS)
+      {
+        Serial << endl << endl;
+        return false;
+      }
+      snprintf(row, sizeof(row), " - %02d : %3hd | 0x%02hx", listing_row + 1, m_config->readNV(listing_row + 1), m_config->readNV(listing_row + 1));
+      Serial << row << endl;
+      break;
+
+    case LISTING_SCOPE:
+      if (!Controller.scope().dump_sample(Serial, listing_row))
+      {
+        Serial << F(SCOPE_DUMP_END) << endl;
+        return false;
+      }
+      break;
+
+    default:
+      return false;
+  }
+  listing_row++;
+  return true;
+}
 
-        sprintf(msgstr, "  max events = %d, EVs per event = %d, bytes per event = %d", m_config.EE_MAX_EVENTS, m_config.EE_NUM_EVS, m_config.EE_BYTES_PER_EVENT);
-        Serial << msgstr << endl;
+static void listing_start(t_listing which)
+{
+  char msgstr[80];
+  byte uev;
+  switch (which)
+  {
+    case LISTING_EVENTS:
+      // EEPROM learned event data table
+      Serial << F("> stored events ") << endl;
+      snprintf(msgstr, sizeof(msgstr), "  max events = %d, EVs per event = %d, bytes per event = %d", m_config->EE_MAX_EVENTS, m_config->EE_NUM_EVS, m_config->EE_BYTES_PER_EVENT);
+      Serial << msgstr << endl;
+      uev = EventIndex.count();
+      Serial << F("  stored events = ") << uev << F(", free = ") << (m_config->EE_MAX_EVENTS - uev) << endl;
+      Serial << F("  using ") << (uev * m_config->EE_BYTES_PER_EVENT) << F(" of ") << (m_config->EE_MAX_EVENTS * m_config->EE_BYTES_PER_EVENT) << F(" bytes") << endl << endl;
+      Serial << F("  Ev#  |  NNhi |  NNlo |  ENhi |  ENlo | ");
+      for (byte j = 0; j < (m_config->EE_NUM_EVS); j++)
+      {
+        snprintf(msgstr, sizeof(msgstr), "EV%03d | ", j + 1);
+        Serial << msgstr;
+      }
+      Serial << F("Hash |") << endl;
+      Serial << F(" --------------------------------------------------------------") << endl;
+      break;
+
+    case LISTING_NVS:
+      Serial << "> Node variables" << endl;
+      Serial << F("   NV   Val") << endl;
+      Serial << F("  --------------------") << endl;
+      break;
+
+    case LISTING_SCOPE:
+      if (!Controller.scope().done())
+      {
+        Serial << F("> scope capture not complete, state = ") << Controller.scope().state() << endl;
+        return;
+      }
+      Serial << F(SCOPE_DUMP_HEADER) << endl;
+      break;
+
+    default:
+      return;
+  }
+  listing = which;
+  listing_row = 0;
+}
 
-        for (byte j = 0; j < m_config.EE_MAX_EVENTS; j++) {
-          if (m_config.getEvTableEntry(j) != 0) {
-            ++uev;
-          }
+// The original single letter commands
+static void single_command(char c)
+{
+  switch (c)
+  {
+    case 'n':
+      // node config
+      printConfig();
+      // node identity
+      Serial << F("> CBUS node configuration") << endl;
+      Serial << F("> mode = ") << (m_config->FLiM ? "FLiM" : "SLiM") << F(", CANID = ") << m_config->CANID << F(", node number = ") << m_config->nodeNum << endl;
+      Serial << endl;
+      break;
+
+    case 'e':
+      listing_start(LISTING_EVENTS);
+      break;
+
+    // NVs
+    case 'v':
+      listing_start(LISTING_NVS);
+      break;
+
+    // CAN bus status
+    case 'c':
+      //CBUS.printStatus();
+      break;
+
+    case 'h':
+      // event hash table
+      m_config->printEvHashTable(false);
+      break;
+
+    case 'y':
+      // reset CAN bus and CBUS message processing
+      //CBUS.reset();
+      break;
+
+    case '*':
+      // reboot
+      m_config->reboot();
+      break;
+
+    case 'm':
+      // free memory
+      Serial << F("> free SRAM = ") << m_config->freeSRAM() << F(" bytes") << endl;
+      break;
+
+    case 'r':
+      // renegotiate
+      //CBUS.renegotiate();
+      break;
+
+    case 'k':
+      // runtime counters
+      Metrics.print(Serial);
+      break;
+
+    case 'K':
+      // clear the runtime counters
+      Metrics.reset();
+      Controller.reset_stats();
+      Serial << F("> runtime metrics cleared") << endl;
+      break;
+
+    case 't':
+      // task run times and jitter
+      Scheduler.report(Serial);
+      break;
+
+    case 'T':
+      Scheduler.reset_stats();
+      Serial << F("> task statistics cleared") << endl;
+      break;
+
+    case 'o':
+      // Arm the scope capture, trigger on a direction change
+      Controller.scope().arm(SCOPE_TRIGGER_DIRECTION, 0);
+      Serial << F("> scope armed, trigger on direction change") << endl;
+      break;
+
+    case 'O':
+      // Arm the scope capture, trigger on BEMF above half scale
+      Controller.scope().arm(SCOPE_TRIGGER_BEMF_ABOVE, SCOPE_DEFAULT_BEMF_THRESHOLD);
+      Serial << F("> scope armed, trigger on BEMF above ") << SCOPE_DEFAULT_BEMF_THRESHOLD << endl;
+      break;
+
+    case 'p':
+      // Print the scope capture, for tools/plot_capture.py
+      listing_start(LISTING_SCOPE);
+      break;
+
+    case 'z':
+      // Reset module, clear EEPROM
+      static bool ResetRq = false;
+      static unsigned long ResWaitTime;
+      if (!ResetRq) {
+        // start timeout timer
+        Serial << F(">Reset & EEPROM wipe requested. Press 'z' again within 2 secs to confirm") << endl;
+        ResWaitTime = millis();
+        ResetRq = true;
+      }
+      else {
+        // This is a confirmed request
+        // 2 sec timeout
+        if (ResetRq && ((millis() - ResWaitTime) > 2000)) {
+          Serial << F(">timeout expired, reset not performed") << endl;
+          ResetRq = false;
         }
-
-        Serial << F("  stored events = ") << uev << F(", free = ") << (m_config.EE_MAX_EVENTS - uev) << endl;
-        Serial << F("  using ") << (uev * m_config.EE_BYTES_PER_EVENT) << F(" of ") << (m_config.EE_MAX_EVENTS * m_config.EE_BYTES_PER_EVENT) << F(" bytes") << endl << endl;
-
-        Serial << F("  Ev#  |  NNhi |  NNlo |  ENhi |  ENlo | ");
-
-        for (byte j = 0; j < (m_config.EE_NUM_EVS); j++) {
-          sprintf(dstr, "EV%03d | ", j + 1);
-          Serial << dstr;
+        else {
+          //Request confirmed within timeout
+          Serial << F(">RESETTING AND WIPING EEPROM") << endl;
+          m_config->resetModule();
+          ResetRq = false;
         }
+      }
+      break;
 
-        Serial << F("Hash |") << endl;
-
-        Serial << F(" --------------------------------------------------------------") << endl;
+    default:
+      Serial << F("> unknown command ") << c << endl;
+      break;
+  }
+}
 
-        // for each event data line
-        for (byte j = 0; j < m_config.EE_MAX_EVENTS; j++) {
+// speed <controller> <step 0..127> [f|r]
+static void speed_command(char *controller, char *step, char *direction)
+{
+  int controllerIndex;
+  int speed;
+  if ((controller == NULL) || (step == NULL))
+  {
+    Serial << F("> usage: speed <controller> <step> [f|r]") << endl;
+    return;
+  }
+  controllerIndex = atoi(controller);
+  speed = atoi(step);
+  if ((controllerIndex < 0) || (controllerIndex >= NUM_CONTROLLERS) || (speed < 0) || (speed > 127))
+  {
+    Serial << F("> speed out of range") << endl;
+    return;
+  }
+  // Top bit set for forwards
+  SessionMngr.setSpeedAndDirection(controllerIndex, speed | (((direction != NULL) && (direction[0] == 'r')) ? 0 : 0x80), 0);
+  if (controllers.session[controllerIndex] != SF_INACTIVE)
+  {
+    SessionMngr.notifyDSPD(controllerIndex);
+  }
+}
 
-          if (m_config.getEvTableEntry(j) != 0) {
-            sprintf(dstr, "  %03d  | ", j);
-            Serial << dstr;
+// mode zero|direct|triangle|bemf
+static void mode_command(char *mode)
+{
+  if (mode == NULL)
+  {
+    Serial << F("> usage: mode zero|direct|triangle|bemf") << endl;
+  }
+  else if (strcmp(mode, "zero") == 0)
+  {
+    Controller.set_wave_mode(MODE_ZERO);
+  }
+  else if (strcmp(mode, "direct") == 0)
+  {
+    Controller.set_wave_mode(MODE_DIRECT);
+  }
+  else if (strcmp(mode, "triangle") == 0)
+  {
+    Controller.set_wave_mode(MODE_TRIANGLE);
+  }
+  else if (strcmp(mode, "bemf") == 0)
+  {
+    Controller.set_wave_mode(MODE_TRIANGLE_BEMF);
+  }
+  else
+  {
+    Serial << F("> unknown mode ") << mode << endl;
+  }
+}
 
-            // for each data byte of this event
-            for (byte e = 0; e < (m_config.EE_NUM_EVS + 4); e++) {
-              sprintf(dstr, " 0x%02hx | ", m_config.readEEPROM(m_config.EE_EVENTS_START + (j * m_config.EE_BYTES_PER_EVENT) + e));
-              Serial << dstr;
-            }
+// scope now|dir|above <level>|below <level>|dump
+static void scope_command(char *trigger, char *level)
+{
+  int threshold = (level != NULL) ? atoi(level) : SCOPE_DEFAULT_BEMF_THRESHOLD;
+  if (trigger == NULL)
+  {
+    Serial << F("> scope state = ") << Controller.scope().state() << endl;
+  }
+  else if (strcmp(trigger, "now") == 0)
+  {
+    Controller.scope().arm(SCOPE_TRIGGER_NOW, 0);
+  }
+  else if (strcmp(trigger, "dir") == 0)
+  {
+    Controller.scope().arm(SCOPE_TRIGGER_DIRECTION, 0);
+  }
+  else if (strcmp(trigger, "above") == 0)
+  {
+    Controller.scope().arm(SCOPE_TRIGGER_BEMF_ABOVE, threshold);
+  }
+  else if (strcmp(trigger, "below") == 0)
+  {
+    Controller.scope().arm(SCOPE_TRIGGER_BEMF_BELOW, threshold);
+  }
+  else if (strcmp(trigger, "dump") == 0)
+  {
+    listing_start(LISTING_SCOPE);
+  }
+  else
+  {
+    Serial << F("> unknown scope trigger ") << trigger << endl;
+  }
+}
 
-            sprintf(dstr, "%4d |", m_config.getEvTableEntry(j));
-            Serial << dstr << endl;
-          }
-        }
+static void print_motor_params(const t_motor_params &params)
+{
+  Serial << F("  offset = ") << params.offset << F(", gain = ") << (params.gain_q2 / 4.0) << F(", stiction = ") << (params.stiction * 16) << endl;
+}
 
-        Serial << endl;
+// cal start|abort|save <controller>|forget <controller>, or the calibration state and results
+static void cal_command(char *action, char *controller)
+{
+  int controllerIndex = (controller != NULL) ? atoi(controller) : -1;
+  motor_calibration &cal = Controller.calibration();
+  if (action == NULL)
+  {
+    Serial << F("> calibration state = ") << cal.state() << endl;
+    if (cal.state() != CAL_IDLE)
+    {
+      Serial << F("  throttle, BEMF") << endl;
+      for (byte step = 0; step < CAL_STEPS; step++)
+      {
+        Serial << F("  ") << cal.step_throttle(step) << F(", ") << cal.step_bemf(step) << endl;
+      }
+    }
+    if (cal.state() == CAL_DONE)
+    {
+      print_motor_params(cal.result());
+    }
+    Serial << F("> in use") << endl;
+    print_motor_params(Controller.motor_params());
+  }
+  else if (strcmp(action, "start") == 0)
+  {
+    cal.start();
+    Serial << F("> calibration sweep started, the loco will run") << endl;
+  }
+  else if (strcmp(action, "abort") == 0)
+  {
+    cal.abort();
+  }
+  else if ((controllerIndex < 0) || (controllerIndex >= NUM_CONTROLLERS))
+  {
+    Serial << F("> usage: cal save|forget <controller>") << endl;
+  }
+  else if (strcmp(action, "save") == 0)
+  {
+    if (cal.state() != CAL_DONE)
+    {
+      Serial << F("> no calibration to save") << endl;
+      return;
+    }
+    MotorProfiles.save(controllers.DCCAddress[controllerIndex], cal.result());
+    SessionMngr.loadMotorProfiles();
+    Serial << F("> saved for address ") << controllers.DCCAddress[controllerIndex] << endl;
+  }
+  else if (strcmp(action, "forget") == 0)
+  {
+    MotorProfiles.forget(controllers.DCCAddress[controllerIndex]);
+    SessionMngr.loadMotorProfiles();
+  }
+  else
+  {
+    Serial << F("> unknown calibration action ") << action << endl;
+  }
+}
 
-        break;
+// blank auto|<ticks>, or the blanking window and the last decay measured
+static void blank_command(char *window)
+{
+  if (window == NULL)
+  {
+    Serial << F("> blanking window = ") << Controller.blanking_window() << F(" ticks, ") << (Controller.adaptive_blanking() ? F("adaptive") : F("fixed")) << endl;
+    Serial << F("  decay =");
+    for (int ticks = 0; ticks <= BLANK_TICKS_MAX; ticks++)
+    {
+      Serial << F(" ") << Controller.decay_sample(ticks);
+    }
+    Serial << endl;
+  }
+  else if (strcmp(window, "auto") == 0)
+  {
+    Controller.set_adaptive_blanking(true);
+  }
+  else if ((atoi(window) >= BLANK_TICKS_MIN) && (atoi(window) <= BLANK_TICKS_MAX))
+  {
+    Controller.set_blanking_window(atoi(window));
+  }
+  else
+  {
+    Serial << F("> usage: blank auto|") << BLANK_TICKS_MIN << F("..") << BLANK_TICKS_MAX << endl;
+  }
+}
 
-      // NVs
-      case 'v':
+static void run_command(char *command)
+{
+  char *save;
+  char *word = strtok_r(command, " \t", &save);
+  char *arg1 = strtok_r(NULL, " \t", &save);
+  char *arg2 = strtok_r(NULL, " \t", &save);
+  char *arg3 = strtok_r(NULL, " \t", &save);
+  if (word == NULL)
+  {
+    return;
+  }
+  if ((word[1] == '\0') && (arg1 == NULL))
+  {
+    single_command(word[0]);
+  }
+  else if (strcmp(word, "speed") == 0)
+  {
+    speed_command(arg1, arg2, arg3);
+  }
+  else if (strcmp(word, "stop") == 0)
+  {
+    SessionMngr.stopAll(false);
+  }
+  else if (strcmp(word, "mode") == 0)
+  {
+    mode_command(arg1);
+  }
+  else if (strcmp(word, "scope") == 0)
+  {
+    scope_command(arg1, arg2);
+  }
+  else if (strcmp(word, "cal") == 0)
+  {
+    cal_command(arg1, arg2);
+  }
+  else if (strcmp(word, "blank") == 0)
+  {
+    blank_command(arg1);
+  }
+  else if (strcmp(word, "wait") == 0)
+  {
+    waiting = true;
+    wait_start = millis();
+    wait_ms = (arg1 != NULL) ? strtoul(arg1, NULL, 10) : 0;
+  }
+  else if (strcmp(word, "echo") == 0)
+  {
+    // Marks a point in the output, for scripts
+    Serial << F("> ") << ((arg1 != NULL) ? arg1 : "") << endl;
+  }
+  else
+  {
+    Serial << F("> unknown command ") << word << endl;
+  }
+}
 
-        // note NVs number from 1, not 0
-        Serial << "> Node variables" << endl;
-        Serial << F("   NV   Val") << endl;
-        Serial << F("  --------------------") << endl;
+// Run the next command of the current line, if nothing is holding it back
+static void run_script(void)
+{
+  char *command;
+  char *end;
+  if (waiting)
+  {
+    if ((millis() - wait_start) < wait_ms)
+    {
+      return;
+    }
+    waiting = false;
+  }
+  command = script_next;
+  end = strchr(command, ';');
+  if (end != NULL)
+  {
+    *end = '\0';
+    script_next = end + 1;
+  }
+  else
+  {
+    script_next = NULL;
+  }
+  run_command(command);
+  if (script_next == NULL)
+  {
+    // The line has finished, so a wait at the end of it holds nothing back
+    waiting = false;
+  }
+}
 
-        for (byte j = 1; j <= m_config.EE_NUM_NVS; j++) {
-          sprintf(msgstr, " - %02d : %3hd | 0x%02hx", j, m_config.readNV(j), m_config.readNV(j));
-          Serial << msgstr << endl;
-        }
+void processSerialInput(void) {
 
-        Serial << endl << endl;
+  char c;
 
-        break;
-
-      // CAN bus status
-      case 'c':
-
-        //CBUS.printStatus();
-        break;
-
-      case 'h':
-        // event hash table
-        m_config.printEvHashTable(false);
-        break;
-
-      case 'y':
-        // reset CAN bus and CBUS message processing
-        //CBUS.reset();
-        break;
-
-      case '*':
-        // reboot
-        m_config.reboot();
-        break;
-
-      case 'm':
-        // free memory
-        Serial << F("> free SRAM = ") << m_config.freeSRAM() << F(" bytes") << endl;
-        break;
-
-      case 'r':
-        // renegotiate
-        //CBUS.renegotiate();
-        break;
-
-      case 'z':
-        // Reset module, clear EEPROM
-        static bool ResetRq = false;
-        static unsigned long ResWaitTime;
-        if (!ResetRq) {
-          // start timeout timer
-          Serial << F(">Reset & EEPROM wipe requested. Press 'z' again within 2 secs to confirm") << endl;
-          ResWaitTime = millis();
-          ResetRq = true;
-        }
-        else {
-          // This is a confirmed request
-          // 2 sec timeout
-          if (ResetRq && ((millis() - ResWaitTime) > 2000)) {
-            Serial << F(">timeout expired, reset not performed") << endl;
-            ResetRq = false;
-          }
-          else {
-            //Request confirmed within timeout
-            Serial << F(">RESETTING AND WIPING EEPROM") << endl;
-            m_config.resetModule();
-            ResetRq = false;
-          }
-        }
-        break;
+  // Finish any listing before running anything else
+  if (listing != LISTING_NONE)
+  {
+    if (Serial.availableForWrite() >= SERIAL_ROW_SPACE)
+    {
+      if (!listing_row_print())
+      {
+        listing = LISTING_NONE;
+      }
+    }
+    return;
+  }
 
-      case '\r':
-      case '\n':
-        Serial << endl;
-        break;
+  if (script_next != NULL)
+  {
+    run_script();
+    return;
+  }
 
-      default:
-        // Serial << F("> unknown command ") << c << endl;
-        break;
+  for (byte n = 0; (n < SERIAL_CHARS_PER_PASS) && Serial.available(); n++)
+  {
+    c = Serial.read();
+    if ((c == '\r') || (c == '\n'))
+    {
+      if (line_len > 0)
+      {
+        line[line_len] = '\0';
+        memcpy(script, line, line_len + 1);
+        script_next = script;
+        line_len = 0;
+        return;
+      }
+    }
+    else if (line_len < (SERIAL_LINE_LEN - 1))
+    {
+      line[line_len++] = c;
     }
   }
-}
\ No newline at end of file
+}
@@ -16,8 +16,9 @@
 #include "dc_controller.h"
 #include "throttle.h"
 
-void cbus_serial_setup(CBUSConfig params);
+void cbus_serial_setup(CBUSConfig *config);
 
+// Called on every pass of loop(), never waits
 void processSerialInput(void);
 
 void printConfig(void);
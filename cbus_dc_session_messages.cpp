@@ -17,11 +17,15 @@
 #include "dc_controller_defs.h"
 #include "cbus_dc_sessions.h"        // CBUS message functions
 #include "cbus_dc_messages.h"        // CBUS message functions
+#include "cbus_dc_session_messages.h"
+#include "cbus_dc_coordinator.h"
+#include "cbus_frame.h"
 #include "dc_controller.h"
 #include "throttle.h"
 
 CBUSConfig mod_config;
-CBUSESP32 _CBUS; // CBUS Object
+extern bool cancmd_present;
+extern cbus_dc_coordinator Coordinator;
 
 //bool cancmd_present = false;
 //volatile byte timer_counter = 0;
@@ -32,7 +36,7 @@ CBUSESP32 _CBUS; // CBUS Object
 //volatile boolean shutdownFlag = false;
 
 
-void message_setup(CBUSConfig params)
+void cbus_dc_session_messages::message_setup(CBUSConfig params)
 {
   mod_config = params;
 }
@@ -42,70 +46,11 @@ void message_setup(CBUSConfig params)
 //bool cbus_dc_messages::sendMessage(byte len, const byte *buf)
 bool sendMessage(byte len, const byte *buf)
 {
-    CANFrame msg;
-    msg.id = mod_config.CANID;
-    msg.len = len;
-    for(byte i = 0;  i< len; i++)
-    {
-       msg.data[i] = buf[i];
-    }
-    msg.ext = false;
-    msg.rtr = false;
-  
-    bool res = _CBUS.sendMessage(&msg);
-#if DEBUG
-    if (res) {
-      Serial << F("> sent CBUS message with code [ 0x") << _HEX(buf[0]) << F(" ] and size ") << len << endl;
-      if (len > 1) {
-        Serial << F("> Data : [");
-        for(byte i = 1;  i< len; i++)
-         {
-            Serial << F(" 0x") << buf[i];
-         }
-        Serial << F(" ]") << endl;
-      }
-    } else {
-      Serial << F("> error sending CBUS message") << endl;
-    }
-#endif
-    return res;
- }
+    return cbus_send_frame(len, buf);
+}
 //
 // Execution routines to be added.
 //
-/**
-
-/*
-* Send a DSPD message to CABs showing speed/direction
-*/
-void sendDSPD(byte controllerIndex)
-{
-
-  unsigned char buf[3];
-
-#if DEBUG
-  Serial.print(F("Send DSPD "));
-#endif
-    buf[0] = 0x47; // OPC_DSPD
-    buf[1] = controllers[controllerIndex].session;
-    buf[2] = controllers[controllerIndex].trainController.getSpeed() | (controllers[controllerIndex].trainController.getDirection() * 0x80);
-    sendMessage(3, buf);
-  //CAN0.sendMsgBuf(((unsigned long)canId.id) << 5, 3, buf);
-#if DEBUG
-  Serial.print(F("CAN msg: "));
-  for (int i = 0; i < 3; i++)                // Print each byte of the data
-  {
-    Serial.print(F(" "));
-    if (buf[i] < 0x10)                     // If data byte is less than 0x10, add a leading zero
-    {
-      Serial.print(F("0"));
-    }
-    Serial.print(buf[i], HEX);
-  }
-  Serial.println();
-#endif
-
-}
 
 #if 0 // IB
 // N beeps
@@ -156,7 +101,7 @@ void setupDisplay()
 #endif
 
     display.setCursor(x_pos, y_pos);
-    display.print(controllers[controllerIndex].DCCAddress); // display DCC address
+    display.print(controllers.DCCAddress[controllerIndex]); // display DCC address
  //   if (init)
 //    {
 //#if OLED_DISPLAY
@@ -192,38 +137,15 @@ void showSpeeds()
 
 }
 #endif
-* Stop all DC tracks
-* Loop over every session and if it is not free set
-* the speed to 0 (stop) or 1 (eStop)
-*/
-void stopAll(boolean emergency)
-{
-  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
-  {
-    // stop all active controllers
-    if (controllers[controllerIndex].session != SF_INACTIVE)
-    {
-      if (emergency)
-        controllers[controllerIndex].trainController.emergencyStop();
-      else
-        controllers[controllerIndex].trainController.setSpeed(0);
-      // update the speed display.
-      // IB displaySpeed(controllerIndex);
-      sendDSPD(controllerIndex);
-    }
-  }
-#if CBUS_EVENTS
-  sendEvent(OPC_ACON,(byte)EventNo::stopEvent);
-  stopEventOn = true;
-#endif
-}
+#endif // of IB
+
 //
 /// user-defined frame processing function
 /// called from the CBUS library for *every* CAN frame received
 /// it receives a pointer to the received CAN frame
 //  Added from new version of CBUS_empty
 
-void messagehandler(CANFrame *msg){
+void cbus_dc_session_messages::messagehandler(CANFrame *msg){
 
   int id;
   long unsigned int dcc_address;
@@ -279,6 +201,10 @@ void messagehandler(CANFrame *msg){
 #endif
 
           //IB TBA sesions_reset();
+          if (!Coordinator.isPeer(msg->id & 0x7f))
+          {
+            commandStationSeen();
+          }
           // -------------------------------------------------------------------
         case OPC_RTOF:
 #if DEBUG
@@ -315,7 +241,8 @@ void messagehandler(CANFrame *msg){
 #if DEBUG
           Serial.println(F("DKEEP - keep alive"));
 #endif
-          sessions_updateProcessing(true);
+          // Inertia is stepped by its own task, so only check the timeouts here
+          updateProcessing(false);
 
           keepaliveSession(msg->data[1]);
           break;
@@ -348,6 +275,9 @@ void messagehandler(CANFrame *msg){
              Serial << F("Calling locoRequest (") << dcc_address << F(",") << long_address << F(")")<< endl;
 #endif
              locoRequest(dcc_address, long_address, 0);
+           } else if ((long_address == 0) && (dcc_address > 0) && (dcc_address < 128)) {
+             // A short address that is not one of ours may be a consist
+             consistRequest(dcc_address);
            } else {
 #if DEBUG
              Serial << F("Calling locoRequest not called for (") << dcc_address << F(",") << long_address << F(")")<< endl;
@@ -403,24 +333,30 @@ void messagehandler(CANFrame *msg){
           byte session = msg->data[1];
           byte requestedSpeed = msg->data[2]; // & 0x7f;
           //byte requestedDirection = msg->data[2] & 0x80;
-          controllerIndex = getSessionIndex(session);
-          if (controllerIndex > SF_INACTIVE)
+          int sessionIndex = getSessionIndex(session);
+          if (sessionIndex != SF_INACTIVE)
           {
+            controllerIndex = sessionIndex;
             /*if (requestedSpeed == 1)
             {
               // emergency stop
-              controllers[controllerIndex].trainController.emergencyStop();
+              controllers.trainController[controllerIndex].emergencyStop();
             }
             else */
             //{
                setSpeedAndDirection(controllerIndex, requestedSpeed, 0);
-            // controllers[controllerIndex].trainController.setSpeedAndDirection(msg->data[2] & 0x80, requestedSpeed);
+            // controllers.trainController[controllerIndex].setSpeedAndDirection(msg->data[2] & 0x80, requestedSpeed);
             //}
             // update the speed display now done in setSpeedAndDirection
             //displaySpeed(controllerIndex);
           }
-          // update processing and reset the timeout
-          sessions_updateProcessing(true);
+          else if (session & 0x80)
+          {
+            // A consist session, which may have members here
+            setConsistSpeed(session, requestedSpeed);
+          }
+          // check the timeouts and reset this one, inertia is stepped by its own task
+          updateProcessing(false);
           keepaliveSession(session);
 
           break;
@@ -434,7 +370,11 @@ void messagehandler(CANFrame *msg){
           
         // -------------------------------------------------------------------
         case OPC_PLOC:                              // PLOC session Allocate from CANCMD
-           cancmd_present = true; // message came from CANCMD, so must be present
+           // Consist PLOCs from the leading DC controller module do not mean there is a CANCMD
+           if (!Coordinator.isPeer(msg->id & 0x7f))
+           {
+             commandStationSeen(); // message came from CANCMD, so must be present
+           }
            dcc_address = msg->data[3] + ((msg->data[2] & 0x3f) << 8);
            long_address = (msg->data[2] & SF_LONG);
  #if DEBUG
@@ -451,15 +391,48 @@ void messagehandler(CANFrame *msg){
            Serial.println(dcc_address);
  #endif
           //IBPLOC function
+          if ((msg->data[1] & 0x80) == 0)
+          {
+            // A loco session, which may be for one of our addresses
+            locoSession(msg->data[1], dcc_address, long_address, (msg->data[4] & 0x80) ? SF_FORWARDS : SF_REVERSE, msg->data[4] & 0x7f);
+          }
+          // A consist session allocated by the leading module applies to our members too
+          if ((msg->data[1] & 0x80) && (msg->data[2] == 0))
+          {
+            for (int controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+            {
+              if (controllers.consist[controllerIndex].address == msg->data[3])
+              {
+                controllers.consist[controllerIndex].session = msg->data[1];
+              }
+            }
+          }
           break;
           
+        // -------------------------------------------------------------------
+        case OPC_ERR:                                // Error from the command station
+          // The CANCMD has answered a request, if only to refuse it
+          if (!Coordinator.isPeer(msg->id & 0x7f))
+          {
+            commandStationSeen();
+          }
+          break;
+
         // -------------------------------------------------------------------
         case OPC_RESTP:                              // Emergency stop all OPC_RESTP
         // RESTP function
-// sessions_restp()
+          // The outputs were cut in the frame handler, now stop the sessions
+          restp();
           // Tell all the CABs and Throttles
           emergencyStopAll();
           break;
+
+        // -------------------------------------------------------------------
+        case OPC_ESTOP:                              // Emergency stop all from the command station
+          // The outputs were cut in the frame handler, now stop the sessions so they
+          // restart on the next speed change. The CABs have already seen the ESTOP.
+          restp();
+          break;
  
         // -------------------------------------------------------------------
         case OPC_ACOF:
@@ -574,7 +547,7 @@ void cbus_dc_messages::framehandler(CANFrame *msg) {
   return;
 }
 #else
-void cbus_dc_messages::framehandler(CANFrame *msg) {
+void cbus_dc_session_messages::framehandler(CANFrame *msg) {
 
 #if DEBUG
           Serial << F("Message received with Opcode [ 0x") << _HEX(msg->data[0]) << F(" ]")<< endl;
@@ -584,6 +557,8 @@ void cbus_dc_messages::framehandler(CANFrame *msg) {
   return;
 }
 #endif
+
+#if 0 // IB
 // Task to increment timeout counters on active tasks.
 void incrementTimeoutCounters()
 {
@@ -0,0 +1,57 @@
+//
+//  cbus_dc_session_pool.cpp
+//
+//  Session number pool for standalone working (no CANCMD on the bus).
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "cbus_dc_session_pool.h"
+
+cbus_dc_session_pool::cbus_dc_session_pool(void)
+{
+  clear();
+}
+
+void cbus_dc_session_pool::clear(void)
+{
+  for (byte word = 0; word < SESSION_POOL_WORDS; word++)
+  {
+    _free[word] = 0xffffffffUL;
+  }
+  // Session 0 is not a valid session
+  _free[0] &= ~1UL;
+}
+
+int cbus_dc_session_pool::allocate(void)
+{
+  byte bit;
+  for (byte word = 0; word < SESSION_POOL_WORDS; word++)
+  {
+    if (_free[word] != 0)
+    {
+      bit = __builtin_ctz(_free[word]);
+      _free[word] &= ~(1UL << bit);
+      return (word << 5) + bit;
+    }
+  }
+  return SESSION_NONE;
+}
+
+void cbus_dc_session_pool::claim(byte session)
+{
+  if ((session != 0) && (session < SESSION_POOL_SIZE))
+  {
+    _free[session >> 5] &= ~(1UL << (session & 0x1f));
+  }
+}
+
+void cbus_dc_session_pool::release(byte session)
+{
+  if ((session != 0) && (session < SESSION_POOL_SIZE))
+  {
+    _free[session >> 5] |= (1UL << (session & 0x1f));
+  }
+}
@@ -0,0 +1,45 @@
+//
+//  cbus_dc_session_pool.h
+//
+//  Session number pool for standalone working (no CANCMD on the bus).
+//
+//  Loco sessions are numbered 1..127, as sessions with the top bit set are
+//  consist sessions (consist address | 0x80). Free numbers are held as a bit set,
+//  so allocating is a count trailing zeros over at most four words, and claiming
+//  or releasing a number is a single bit operation.
+//  Sessions seen allocated or released on the bus are claimed or released as well,
+//  so numbers given out by other modules are not reused.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_session_pool_h
+#define cbus_dc_session_pool_h
+
+#include <arduino.h>
+
+const byte SESSION_POOL_SIZE = 128;                      // Session numbers 0..127, 0 is never used
+const byte SESSION_POOL_WORDS = SESSION_POOL_SIZE / 32;
+const int SESSION_NONE = -1;
+
+class cbus_dc_session_pool
+{
+  uint32_t _free[SESSION_POOL_WORDS];                     // Bit set for each free session number
+
+public:
+  cbus_dc_session_pool(void);
+  // Free every session number
+  void clear(void);
+  // Lowest free session number, now taken, or SESSION_NONE if all are in use
+  int allocate(void);
+  // Mark a session number as in use, when it has been allocated elsewhere
+  void claim(byte session);
+  void release(byte session);
+  bool inUse(byte session)
+  {
+    return (session == 0) || (session >= SESSION_POOL_SIZE) || !(_free[session >> 5] & (1UL << (session & 0x1f)));
+  }
+};
+
+#endif
@@ -18,6 +18,10 @@
 #include "cbus_dc_sessions.h"        // CBUS session functions
 #include "dc_controller.h"
 #include "throttle.h"
+#include "cbus_dc_coordinator.h"
+#include "cbus_dc_session_pool.h"
+#include "cbus_frame.h"
+#include "motor_profile.h"
 
 
 #if SET_INERTIA_RATE
@@ -27,9 +31,62 @@
 #define startAddress 1000     // multiplier for DCC address offset from device address. 
 // Device 0 uses 1000, device 1 uses 2000,...
 
-bool cancmd_present;
+// Assume a CANCMD is present until it fails to answer a cab
+bool cancmd_present = true;
 byte deviceAddress = 0;
-cbus_dc_messages _messenger;
+cbus_dc_consists consists;
+cbus_dc_session_pool sessionPool;
+
+// A cab request for one of our addresses, waiting for the CANCMD to answer it
+struct {
+  boolean       waiting;
+  unsigned int  address;
+  byte          longAddress;
+  byte          flags;
+  unsigned long time;
+} pendingRequest = { false, 0, 0, 0, 0 };
+
+// What each controller's cabs were last told by DSPD, and which may have changed since
+struct {
+  int           session;
+  byte          speedDir;
+  unsigned long time;
+} dspdSent[NUM_CONTROLLERS];
+uint32_t dspdDirty = 0;
+unsigned long dspdBatchTime = 0;
+extern cbus_dc_coordinator Coordinator;
+extern motor_profiles MotorProfiles;
+
+t_controllers controllers;
+
+t_controllers::t_controllers(void)
+#if LINKSPRITE || TOWNSEND
+                // Values taken from the motor shield example code
+  : trainController{ trainControllerClass(pinI1, pinI2, pwmpins[0])
+                   , trainControllerClass(pinI3, pinI4, pwmpins[1]) }
+#elif CBUS
+  : trainController{ trainControllerClass(22, 23, pwmpins[0])
+                   , trainControllerClass(24, 25, pwmpins[1])
+                   , trainControllerClass(26, 27, pwmpins[2])
+                   , trainControllerClass(28, 29, pwmpins[3])
+                   , trainControllerClass(30, 31, pwmpins[4])
+                   , trainControllerClass(32, 33, pwmpins[5])
+                 //, trainControllerClass(14, 15, pwmpins[6])
+                 //, trainControllerClass(16, 17, pwmpins[7])
+                   }
+#endif
+{
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    session[controllerIndex] = SF_INACTIVE;
+    timeout[controllerIndex] = 0;
+    DCCAddress[controllerIndex] = (startAddress * (deviceAddr + 1)) + controllerIndex + 1;
+    longAddress[controllerIndex] = SF_LONG;
+    consist[controllerIndex] = { 0, 0, false };
+  }
+  active = 0;
+  shared = 0;
+}
 
 cbus_dc_sessions::cbus_dc_sessions()
 {
@@ -38,22 +95,24 @@ cbus_dc_sessions::cbus_dc_sessions()
 
 void cbus_dc_sessions::setup(void)
 {
-  // System Reset (Sent by CANCMD on power up)
-  cancmd_present = true; // message came from CANCMD, so must be present
+  // Sessions are all released, whether or not a CANCMD is present
+  sessionPool.clear();
+  pendingRequest.waiting = false;
 
   for (int controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
     // release all active controllers
-    if (controllers[controllerIndex].session > SF_INACTIVE)
+    if (controllers.session[controllerIndex] > SF_INACTIVE)
     {
-      controllers[controllerIndex].trainController.emergencyStop(); // Emergency Stop
-      controllers[controllerIndex].session = SF_INACTIVE;
+      controllers.trainController[controllerIndex].emergencyStop(); // Emergency Stop
+      controllers.setSession(controllerIndex, SF_INACTIVE);
       // update the speed display.
       //ib displaySpeed(controllerIndex);
     }
     // release all consists
-    controllers[controllerIndex].consist = { 0, false, false };
+    controllers.consist[controllerIndex] = { 0, false, false };
   }
+  consists.clear();
 }
 
 // ploc function
@@ -62,18 +121,18 @@ void cbus_dc_sessions::ploc(CANFrame *msg, long unsigned int dcc_address, int lo
   // only interested in the addresses of our analogue outputs
   for (int controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
-    if (controllers[controllerIndex].DCCAddress == dcc_address  && controllers[controllerIndex].longAddress == long_address)
+    if (controllers.DCCAddress[controllerIndex] == dcc_address  && controllers.longAddress[controllerIndex] == long_address)
     {
       int requestedSpeed = msg->data[4] & 0x7f;
-      controllers[controllerIndex].session = msg->data[1];
+      controllers.setSession(controllerIndex, msg->data[1]);
       if (requestedSpeed == 1)
       {
         // emergency stop
-        controllers[controllerIndex].trainController.emergencyStop();
+        controllers.trainController[controllerIndex].emergencyStop();
       }
       else
       {
-        controllers[controllerIndex].trainController.setSpeedAndDirection((msg->data[4] & 0x80) >> 3, msg->data[4] & 0x7f);
+        controllers.trainController[controllerIndex].setSpeedAndDirection((msg->data[4] & 0x80) >> 3, msg->data[4] & 0x7f);
       }
     }
   }
@@ -82,25 +141,14 @@ void cbus_dc_sessions::ploc(CANFrame *msg, long unsigned int dcc_address, int lo
 // RESTP function
 void cbus_dc_sessions::restp(void)
 {
-  for (int controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
-  {
-    // stop all active controllers
-    if (controllers[controllerIndex].session != SF_INACTIVE)
-    {
-#if DEBUG
-      Serial << F("Controller ") << controllerIndex << F(" active")<< endl;
-#endif
-      controllers[controllerIndex].trainController.emergencyStop ();
-      // update the speed display.
-      // IB displaySpeed(controllerIndex);
-    }
-    else
-    {
+  // stop all active controllers
 #if DEBUG
-      Serial << F("Controller ") << controllerIndex << F(" inactive")<< endl;
+  Serial.print(F("Active controllers 0x"));
+  Serial.println(controllers.active, HEX);
 #endif
-    }
-  }
+  emergencyStopMask(controllers.active);
+  // update the speed display.
+  // IB displaySpeed(controllerIndex);
 }
 
 //IB session timeout funtion
@@ -109,12 +157,12 @@ void cbus_dc_sessions::restp(void)
 
 void cbus_dc_sessions::increment(void)
 {
-  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  uint32_t active = controllers.active;
+  while (active)
   {
-    if (controllers[controllerIndex].session != SF_INACTIVE)
-    {
-      ++controllers[controllerIndex].timeout; // increment timeout counter by 1
-    }
+    byte controllerIndex = __builtin_ctz(active);
+    active &= active - 1;
+    ++controllers.timeout[controllerIndex]; // increment timeout counter by 1
   }
 }
 
@@ -122,26 +170,36 @@ void cbus_dc_sessions::increment(void)
 void cbus_dc_sessions::updateProcessing(bool updateNow)
 {
   byte controllerIndex;
+  int session;
+  uint32_t active = controllers.active;
   // No CBus message received this time round the loop, so check the sessions for timeout
-  for (controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  while (active)
   {
-    if ((controllers[controllerIndex].session != SF_INACTIVE) && (controllers[controllerIndex].timeout > MAXTIMEOUT))
+    controllerIndex = __builtin_ctz(active);
+    active &= active - 1;
+    if (controllers.timeout[controllerIndex] > MAXTIMEOUT)
     {
+      session = controllers.session[controllerIndex];
 #if DEBUG
       Serial.print("Session ");
-      Serial.print(controllers[controllerIndex].session);
+      Serial.print(session);
       Serial.print(" Address ");
-      Serial.print(controllers[controllerIndex].DCCAddress);
+      Serial.print(controllers.DCCAddress[controllerIndex]);
       Serial.println(" Timed Out.");
 #endif
-      controllers[controllerIndex].trainController.setSpeedAndDirection(0, 0);
-      releaseLoco(controllers[controllerIndex].session);
-      sendSessionError(controllers[controllerIndex].session, ErrorState::sessionCancelled); // Send session cancelled message out to CABs
+      Metrics.sessionTimeout();
+      controllers.trainController[controllerIndex].setSpeedAndDirection(0, 0);
+      releaseLoco(session);
+      sendSessionError(session, ErrorState::sessionCancelled); // Send session cancelled message out to CABs
     }
+  }
 
-    if (updateNow)
+  // Released controllers still ramp down, so every one is updated
+  if (updateNow)
+  {
+    for (controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
     {
-      controllers[controllerIndex].trainController.matchToTargets ();
+      controllers.trainController[controllerIndex].matchToTargets ();
         // update the speed display.
         // IB displaySpeed(controllerIndex);
     }
@@ -156,7 +214,7 @@ int cbus_dc_sessions::getSessionIndex (byte session)
   int controllerIndex;
   for (controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
-    if (controllers[controllerIndex].session == session)
+    if (controllers.session[controllerIndex] == session)
     {
       return controllerIndex;
     }
@@ -170,7 +228,7 @@ int cbus_dc_sessions::getDCCIndex (unsigned int dcc_address, byte long_address)
   int controllerIndex;
   for (controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
-    if ((controllers[controllerIndex].DCCAddress == dcc_address) && (controllers[controllerIndex].longAddress == long_address))
+    if ((controllers.DCCAddress[controllerIndex] == dcc_address) && (controllers.longAddress[controllerIndex] == long_address))
     {
       return controllerIndex;
     }
@@ -185,15 +243,18 @@ int cbus_dc_sessions::getDCCIndex (unsigned int dcc_address, byte long_address)
 void cbus_dc_sessions::releaseLoco(byte session)
 {
   int controllerIndex = getSessionIndex(session);
+  // The session number is free again, wherever it was allocated
+  sessionPool.release(session);
   if (controllerIndex >= 0)
   {
-    controllers[controllerIndex].session = SF_INACTIVE;
-    controllers[controllerIndex].timeout = 0;
+    controllers.setSession(controllerIndex, SF_INACTIVE);
+    controllers.timeout[controllerIndex] = 0;
+    controllers.setShared(controllerIndex, false);
 #if DEBUG
   Serial.print("Session ");
   Serial.print(session);
   Serial.print(" Address ");
-  Serial.print(controllers[controllerIndex].DCCAddress);
+  Serial.print(controllers.DCCAddress[controllerIndex]);
   Serial.println(" Released.");
 #endif
     // update the speed display.
@@ -247,10 +308,11 @@ void cbus_dc_sessions::locoSession(byte session, unsigned int address, byte long
      Serial.print(" DCC address ");
      Serial.println(address);
    #endif
+  sessionPool.claim(session);
   if (controllerIndex >= 0)
   {
-    controllers[controllerIndex].session = session;
-    controllers[controllerIndex].trainController.setSpeedAndDirection(direction_, speed_);
+    controllers.setSession(controllerIndex, session);
+    controllers.trainController[controllerIndex].setSpeedAndDirection(direction_, speed_);
     // update the speed display.
     // IB displaySpeed(controllerIndex);
   }
@@ -264,7 +326,7 @@ void cbus_dc_sessions::keepaliveSession(byte session)
   int controllerIndex = getSessionIndex(session);
   if (controllerIndex >= 0)
   {
-    controllers[controllerIndex].timeout = 0;
+    controllers.timeout[controllerIndex] = 0;
   }
 }
 
@@ -276,66 +338,122 @@ void cbus_dc_sessions::keepaliveSession(byte session)
 void cbus_dc_sessions::locoRequest(unsigned int address, byte long_address, byte flags)
 {
   int controllerIndex = getDCCIndex(address, long_address);
+  int session;
 #if DEBUG
   Serial.println("locoRequest");
 #endif
-  // only respond if working standalone
-  if (cancmd_present == false)
+  if (cancmd_present)
   {
-#if DEBUG
-    Serial.println("Standalone");
-#endif
+    // Give the CANCMD a chance to answer, and take over if it does not
     if (controllerIndex >= 0)
     {
-      // This is a DCC Address associated with our controllers
-      if (controllers[controllerIndex].session != SF_INACTIVE)
-      {
-        // Loco is already used in a session
+      pendingRequest = { true, address, long_address, flags, millis() };
+    }
+    return;
+  }
 #if DEBUG
-        Serial.print("Loco already allocated to session ");
-        Serial.println(controllers[controllerIndex].session);
-        Serial.print(F("Flag: "));
-        Serial.println(flags);
-#endif
-        if (flags == 0)
-          sendError(address, long_address, ErrorState::locoTaken);    // Send a Taken error
-        else if (flags == 1)        // Steal
-        {
-          sendError(address, long_address, ErrorState::sessionCancelled);
-          controllers[controllerIndex].session = SF_INACTIVE;
-#if KEYPAD
-          controllers[keyFSM.currentLoco].shared = false;
+  Serial.println("Standalone");
 #endif
-        }
-        else if (flags == 2)        // Share
-        {
-          sendPLOC(controllers[controllerIndex].session);
-#if KEYPAD
-          controllers[keyFSM.currentLoco].shared = true;
+  if (controllerIndex < 0)
+  {
+    // This DCC Address is not associated with any of our controllers
+    sendError(address, long_address, ErrorState::invalidRequest);
+    return;
+  }
+  if (controllers.session[controllerIndex] != SF_INACTIVE)
+  {
+    // Loco is already used in a session
+#if DEBUG
+    Serial.print("Loco already allocated to session ");
+    Serial.println(controllers.session[controllerIndex]);
+    Serial.print(F("Flag: "));
+    Serial.println(flags);
 #endif
-        }
-        else
-          sendError(address, long_address, ErrorState::invalidRequest);
-        return;
-      }
+    if (flags == 1)              // Steal
+    {
+      // Cancel the old session and fall through to give the loco a new one
+      sendSessionError(controllers.session[controllerIndex], ErrorState::sessionCancelled);
+      releaseLoco(controllers.session[controllerIndex]);
+    }
+    else if (flags == 2)         // Share
+    {
+      controllers.setShared(controllerIndex, true);
+      sendPLOC(controllers.session[controllerIndex]);
+      return;
     }
     else
     {
-      // This DCC Address is not associated with any of our controllers
-      sendError(address, long_address, ErrorState::invalidRequest);
+      sendError(address, long_address, (flags == 0) ? ErrorState::locoTaken : ErrorState::invalidRequest);
       return;
     }
-    // If we have got this far then the controller is not in use
-    // set a new session number for the controller to use
-   
-    locoSession(controllerIndex, address, long_address, SF_FORWARDS, 0);
- #if DEBUG
-        Serial.print("Session Allocated: ");
-        Serial.println(controllers[controllerIndex].session);
- #endif
-    sendPLOC(controllers[controllerIndex].session);
   }
-  // Do nothing if there is a CANCMD present - it will assign sessions.
+  // If we have got this far then the controller is not in use
+  // so give it the next free session number
+  session = sessionPool.allocate();
+  if (session == SESSION_NONE)
+  {
+    sendError(address, long_address, ErrorState::locoStackFull);
+    return;
+  }
+  locoSession(session, address, long_address, SF_FORWARDS, 0);
+  controllers.timeout[controllerIndex] = 0;
+#if DEBUG
+  Serial.print("Session Allocated: ");
+  Serial.println(session);
+#endif
+  sendPLOC(session);
+}
+
+/*
+ * A frame that only a CANCMD sends has been seen, so it is present and
+ * answering requests itself
+ */
+void cbus_dc_sessions::commandStationSeen(void)
+{
+  cancmd_present = true;
+  pendingRequest.waiting = false;
+}
+
+/*
+ * Called from loop(). If the CANCMD has not answered a request for one of our
+ * addresses in time, it has gone, so work standalone and answer it ourselves.
+ */
+void cbus_dc_sessions::checkCommandStation(void)
+{
+  if (!pendingRequest.waiting || ((millis() - pendingRequest.time) < CANCMD_RESPONSE_MS))
+  {
+    return;
+  }
+  pendingRequest.waiting = false;
+  if (cancmd_present)
+  {
+#if DEBUG
+    Serial.println(F("No answer from CANCMD, working standalone"));
+#endif
+    cancmd_present = false;
+    if ((pendingRequest.longAddress == 0) && (getDCCIndex(pendingRequest.address, 0) == SF_UNHANDLED))
+    {
+      consistRequest(pendingRequest.address);
+    }
+    else
+    {
+      locoRequest(pendingRequest.address, pendingRequest.longAddress, pendingRequest.flags);
+    }
+  }
+}
+
+/*
+ * Mark the sessions the controllers already hold (after a warm start) as in use
+ */
+void cbus_dc_sessions::claimSessions(void)
+{
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    if (controllers.session[controllerIndex] != SF_INACTIVE)
+    {
+      sessionPool.claim(controllers.session[controllerIndex]);
+    }
+  }
 }
 
 /*
@@ -349,8 +467,17 @@ void cbus_dc_sessions::consistRequest(unsigned int address)
 #if DEBUG
   Serial.println(F("ConsistRequest"));
 #endif
-  // only respond if working standalone
-  if (cancmd_present == false)
+  if (cancmd_present)
+  {
+    // Give the CANCMD a chance to answer, and take over if it does not
+    if (Coordinator.isLeader() && Coordinator.consistKnown(address))
+    {
+      pendingRequest = { true, address, 0, 0, millis() };
+    }
+    return;
+  }
+  // only the leading module answers for all of them
+  if (Coordinator.isLeader())
   {
 #if DEBUG
     Serial.println(F("Standalone"));
@@ -358,22 +485,10 @@ void cbus_dc_sessions::consistRequest(unsigned int address)
 #endif
     if ((address > 0) && address < 128)
     {
-      //This is a DCC Address associated with our consists
-      boolean found = false;
-      byte index;
-
-      for (index = 0; index < NUM_CONTROLLERS; index++)
+      // The consist may have members on this module or any of its peers
+      if (Coordinator.consistKnown(address))
       {
-        if (controllers[index].consist.address == address)
-        {
-          found = true;
-          break;
-        }
-      }
-
-      if (found == true)
-      {
-        if (controllers[index].consist.session > 0)
+        if (Coordinator.consistInUse(address))
         {
 #if DEBUG
           Serial.print(F("Consist in use "));
@@ -406,7 +521,14 @@ void cbus_dc_sessions::consistRequest(unsigned int address)
     // If we have got this far then the consist is not in use.
     // Set a new session number for the consist - same as address with MSB to 1.
     // The session id is common across all CANCMDDC instances.
-    controllers[index].consist.session = address | 0x80;
+    for (index = 0; index < NUM_CONTROLLERS; index++)
+    {
+      if (controllers.consist[index].address == address)
+      {
+        controllers.consist[index].session = address | 0x80;
+      }
+    }
+    Coordinator.setConsistInUse(address, true);
 #if DEBUG
     Serial.print(F("Consist Session Allocated: "));
     Serial.println(address | 0x80);
@@ -422,74 +544,36 @@ void cbus_dc_sessions::consistRequest(unsigned int address)
  */
 void cbus_dc_sessions::sendPLOC(byte session)
 {
-  unsigned char buf[8];
   int controllerIndex = getSessionIndex(session);
   // only send this response if working standalone
   if (cancmd_present == false)
   {
    #if DEBUG
      Serial.print("Send PLOC ");
+     Serial.println(session);
    #endif
-    buf[0] = 0xE1; // OPC_PLOC
-    buf[1] = session;
-    buf[2] = ((controllers[controllerIndex].DCCAddress >> 8) & 0x3f) | (controllers[controllerIndex].longAddress);
-    buf[3] = (controllers[controllerIndex].DCCAddress) & 0xff;
-    buf[4] = controllers[controllerIndex].trainController.getSpeed() | (controllers[controllerIndex].trainController.getDirection() ? 0x80 : 0);
-    buf[5] = 0;  // Zero function bytes
-    buf[6] = 0;
-    buf[7] = 0;
-    _messenger.sendMessage(8, buf);
-   #if DEBUG
-          Serial.print("CAN msg: ");
-          for(int i = 0; i<8; i++)                // Print each byte of the data
-          {
-            Serial.print(" ");
-            if(buf[i] < 0x10)                     // If data byte is less than 0x10, add a leading zero
-            {
-              Serial.print("0");
-            }
-            Serial.print(buf[i], HEX);
-          }
-          Serial.println();
-   #endif
+    cbus_send<OPC_PLOC>(session,
+                        ((controllers.DCCAddress[controllerIndex] >> 8) & 0x3f) | (controllers.longAddress[controllerIndex]),
+                        (controllers.DCCAddress[controllerIndex]) & 0xff,
+                        controllers.trainController[controllerIndex].getSpeed() | (controllers.trainController[controllerIndex].getDirection() ? 0x80 : 0),
+                        0, 0, 0);  // Zero function bytes
   }
 }
 
 
 void cbus_dc_sessions::sendPLOCConsist(byte address)
 {
-  unsigned char buf[8];
   // only send this response if working standalone
   if (cancmd_present == false)
   {
-    // only send this response if 1st device on bus - we don't want up to 8 identical messages sent
-    if (deviceAddress == 0)
+    // only send this response from the leading module - we don't want up to 8 identical messages sent
+    if (Coordinator.isLeader())
     {
 #if DEBUG
       Serial.print(F("Send PLOC "));
+      Serial.println(address | 0x80);
 #endif
-        buf[0] = 0xE1; // OPC_PLOC
-        buf[1] = address | 0x80;
-        buf[2] = 0;
-        buf[3] = address;
-        buf[4] = 0;
-        buf[5] = 0;  // Zero function bytes
-        buf[6] = 0;
-        buf[7] = 0;
-        _messenger.sendMessage(8, buf);
-#if DEBUG
-      Serial.print(F("CAN msg: "));
-      for (int i = 0; i < 8; i++)                // Print each byte of the data
-      {
-        Serial.print(F(" "));
-        if (buf[i] < 0x10)                     // If data byte is less than 0x10, add a leading zero
-        {
-          Serial.print(F("0"));
-        }
-        Serial.print(buf[i], HEX);
-      }
-      Serial.println();
-#endif
+      cbus_send<OPC_PLOC>(address | 0x80, 0, address, 0, 0, 0, 0);  // Zero speed and function bytes
     }
   }
 }
@@ -502,21 +586,22 @@ void cbus_dc_sessions::addSessionConsist(byte session, byte consist)
 #endif
 
   // does the session belong to this controller?
-  byte index = getSessionIndex(session);
+  int index = getSessionIndex(session);
 
   if (index == SF_UNHANDLED)
     return;
 
   // is the session already in a consist?
   removeSessionConsist(session);
+  consists.add(index, consist);
 
   // add the consist address to the loco
   // remove for now -
   //invalid narrowing conversion from "int" to "unsigned char"
-  //controllers[index].consist = { (consist & 0x7f), 0, ((consist & 0x80) == 0x80) };
-  controllers[index].consist.address = (consist & 0x7f);
-  controllers[index].consist.session = 0;
-  controllers[index].consist.reverse = ((consist & 0x80) == 0x80);
+  //controllers.consist[index] = { (consist & 0x7f), 0, ((consist & 0x80) == 0x80) };
+  controllers.consist[index].address = (consist & 0x7f);
+  controllers.consist[index].session = 0;
+  controllers.consist[index].reverse = ((consist & 0x80) == 0x80);
   //This works, although the other version does not with that compiler. Oh well.>>>>>>> 9889f22519fb9a2ede20893fbdcefad8d2ff6b54
 }
 
@@ -527,11 +612,43 @@ void cbus_dc_sessions::removeSessionConsist(byte session)
   Serial.println(session);
 #endif
 
-  for (byte i = 0; i < NUM_CONTROLLERS; i++)
+  int index = getSessionIndex(session);
+
+  if (index == SF_UNHANDLED)
+    return;
+
+  consists.remove(index);
+  controllers.consist[index].address = 0;
+  controllers.consist[index].session = 0;
+  controllers.consist[index].reverse = false;
+}
+
+bool cbus_dc_sessions::setConsistSpeed(byte session, byte requestedSpeed)
+{
+  const t_consist *consist = consists.find(session);
+  if (consist == NULL)
+  {
+    return false;
+  }
+#if DEBUG
+  Serial << F("Consist ") << consist->address << F(" speed ") << (requestedSpeed & 0x7f) << F(" to ") << consist->count << F(" members") << endl;
+#endif
+  for (byte member = 0; member < consist->count; member++)
+  {
+    // Reversed members have the direction bit flipped
+    setSpeedAndDirection(consist->members[member], requestedSpeed, ((consist->reverse >> member) & 1) ? 0x80 : 0);
+  }
+  return true;
+}
+
+void cbus_dc_sessions::rebuildConsists(void)
+{
+  consists.clear();
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
   {
-    if (controllers[i].consist.address == (session & 0x7f))
+    if (controllers.consist[controllerIndex].address != 0)
     {
-      controllers[i].consist.session = 0;
+      consists.add(controllerIndex, controllers.consist[controllerIndex].address | (controllers.consist[controllerIndex].reverse ? 0x80 : 0));
     }
   }
 }
@@ -541,19 +658,50 @@ void cbus_dc_sessions::setSpeedAndDirection(byte controllerIndex, byte requested
   if ((requestedSpeed & 0x7F) == 1)
   {
     // emergency stop
-    controllers[controllerIndex].trainController.emergencyStop();
+    controllers.trainController[controllerIndex].emergencyStop();
   }
   else
   {
 #if DEBUG
     Serial << F("Setting speed to ") << (requestedSpeed & 0x7f) << " with reverse " << reverse << endl;
 #endif
-    // IB controllers[controllerIndex].trainController.emergencyStopOff();
-    controllers[controllerIndex].trainController.setSpeedAndDirection(((requestedSpeed & 0x80) ^ reverse) >> 7, requestedSpeed & 0x7f);
+    // IB controllers.trainController[controllerIndex].emergencyStopOff();
+    controllers.trainController[controllerIndex].setSpeedAndDirection(((requestedSpeed & 0x80) ^ reverse) >> 7, requestedSpeed & 0x7f);
   }
   // update the speed display.
   // IB displaySpeed(controllerIndex);
 }
+/*
+ * Load the speed curve for each controller from its NVs (Vstart, Vmid, Vmax)
+ * The curves are expanded into lookup tables here, so the speed change path only does a table read.
+ */
+void cbus_dc_sessions::loadSpeedCurves(CBUSConfig &config)
+{
+  byte nv;
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    nv = NV_SPEED_CURVE_BASE + (controllerIndex * NV_SPEED_CURVE_SIZE);
+    if ((nv + NV_SPEED_CURVE_SIZE - 1) > config.EE_NUM_NVS)
+    {
+      // No NVs left for this controller, so leave it linear
+      controllers.trainController[controllerIndex].setSpeedCurve(0, 0, 0);
+      continue;
+    }
+    controllers.trainController[controllerIndex].setSpeedCurve(config.readNV(nv), config.readNV(nv + 1), config.readNV(nv + 2));
+#if DEBUG
+    Serial << F("> Controller ") << controllerIndex << F(" speed curve ") << config.readNV(nv) << F(",") << config.readNV(nv + 1) << F(",") << config.readNV(nv + 2) << endl;
+#endif
+  }
+}
+
+void cbus_dc_sessions::loadMotorProfiles(void)
+{
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    controllers.trainController[controllerIndex].setMotorParams(MotorProfiles.load(controllers.DCCAddress[controllerIndex]));
+  }
+}
+
 #if SET_INERTIA_RATE
 void setInertiaRate(byte session, byte rate)
 {
@@ -571,7 +719,6 @@ void cbus_dc_sessions::setSpeedSteps(byte session, byte steps)
  */
 void cbus_dc_sessions::sendError(unsigned int address, byte long_address, ErrorState error_code)
 {
-  unsigned char buf[4];
   byte code = (byte)error_code;
 #if DEBUG
   Serial.print("Send Loco ");
@@ -580,11 +727,7 @@ void cbus_dc_sessions::sendError(unsigned int address, byte long_address, ErrorS
   Serial.println(code);
   serialPrintErrorln(code);
 #endif
-  buf[0] = 0x63; // OPC_ERR
-  buf[1] = ((address >> 8) & 0xff) | long_address;
-  buf[2] = address & 0xff;
-  buf[3] = code;
-  _messenger.sendMessage(4, buf);
+  cbus_send<OPC_ERR>(((address >> 8) & 0xff) | long_address, address & 0xff, code);
 }
 
 /**
@@ -592,7 +735,6 @@ void cbus_dc_sessions::sendError(unsigned int address, byte long_address, ErrorS
  */
 void cbus_dc_sessions::sendSessionError(byte session, ErrorState error_code)
 {
-  unsigned char buf[4];
   byte code = (byte)error_code;
 #if DEBUG
   Serial.print("Send Session ");
@@ -600,11 +742,7 @@ void cbus_dc_sessions::sendSessionError(byte session, ErrorState error_code)
   Serial.print(" Error ");
   Serial.println(code);
 #endif
-  buf[0] = 0x63; // OPC_ERR
-  buf[1] = session;
-  buf[2] = 0;
-  buf[3] = code;
-  _messenger.sendMessage(4, buf);
+  cbus_send<OPC_ERR>(session, 0, code);
 }
 
 /**
@@ -612,23 +750,18 @@ void cbus_dc_sessions::sendSessionError(byte session, ErrorState error_code)
  */
 void cbus_dc_sessions::sendReset()
 {
-  unsigned char buf[1];
   int i;
-  buf[0] = 0x07; // OPC_ARST
   for (i=0; i< NUM_CONTROLLERS; i++)
   {
-   _messenger.sendMessage(1, buf);
+   cbus_send<OPC_ARST>();
   }
-  buf[0] = 0x03; // OPC_BON
-  _messenger.sendMessage(1, buf);
+  cbus_send<OPC_BON>();
 }
 
 void cbus_dc_sessions::emergencyStopAll()
 {
-  unsigned char buf[1];
   // Tell all the cabs
-  buf[0] = 0x06; // ESTOP
-  _messenger.sendMessage(1, buf);
+  cbus_send<OPC_ESTOP>();
   // IB beep_counter = 100; // sound buzzer 1 second
 #if CBUS_EVENTS
   sendEvent(OPC_ACON,(byte)EventNo::stopEvent);
@@ -636,6 +769,20 @@ void cbus_dc_sessions::emergencyStopAll()
 #endif
 }
 
+/**
+ * Report an output overload to the CABs of every active controller
+ */
+void cbus_dc_sessions::reportOverload()
+{
+  uint32_t active = controllers.active;
+  while (active)
+  {
+    byte controllerIndex = __builtin_ctz(active);
+    active &= active - 1;
+    sendError(controllers.DCCAddress[controllerIndex], controllers.longAddress[controllerIndex], ErrorState::motorOverload);
+  }
+}
+
 /**
 * Stop all DC tracks
 * Loop over every session and if it is not free set
@@ -643,56 +790,97 @@ void cbus_dc_sessions::emergencyStopAll()
 */
 void cbus_dc_sessions::stopAll(boolean emergency)
 {
-  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  uint32_t active = controllers.active;
+  // stop all active controllers, every output first and then tell the cabs
+  if (emergency)
   {
-    // stop all active controllers
-    if (controllers[controllerIndex].session != SF_INACTIVE)
+    emergencyStopMask(active);
+  }
+  else
+  {
+    for (uint32_t pending = active; pending; pending &= pending - 1)
     {
-      if (emergency)
-        controllers[controllerIndex].trainController.emergencyStop();
-      else
-        controllers[controllerIndex].trainController.setSpeed(0);
-      // update the speed display.
-      // IB displaySpeed(controllerIndex);
-      sendDSPD(controllerIndex);
+      controllers.trainController[__builtin_ctz(pending)].setSpeed(0);
     }
   }
+  while (active)
+  {
+    byte controllerIndex = __builtin_ctz(active);
+    active &= active - 1;
+    // update the speed display.
+    // IB displaySpeed(controllerIndex);
+    notifyDSPD(controllerIndex);
+  }
 #if CBUS_EVENTS
   sendEvent(OPC_ACON,(byte)EventNo::stopEvent);
   stopEventOn = true;
 #endif
 }
 
+/**
+* Emergency stop every controller in the mask, in one pass with nothing else in it
+*/
+void cbus_dc_sessions::emergencyStopMask(uint32_t mask)
+{
+  while (mask)
+  {
+    controllers.trainController[__builtin_ctz(mask)].emergencyStop();
+    mask &= mask - 1;
+  }
+}
+
 /*
 * Send a DSPD message to CABs showing speed/direction
 */
 void cbus_dc_sessions::sendDSPD(byte controllerIndex)
 {
-
-  unsigned char buf[3];
-
+  byte speedDir = controllers.trainController[controllerIndex].getSpeed() | (controllers.trainController[controllerIndex].getDirection() * 0x80);
 #if DEBUG
   Serial.print(F("Send DSPD "));
+  Serial.print(controllers.session[controllerIndex]);
+  Serial.print(F(" "));
+  Serial.println(speedDir, HEX);
 #endif
-    buf[0] = 0x47; // OPC_DSPD
-    buf[1] = controllers[controllerIndex].session;
-    buf[2] = controllers[controllerIndex].trainController.getSpeed() | (controllers[controllerIndex].trainController.getDirection() * 0x80);
-    _messenger.sendMessage(3, buf);
-  //CAN0.sendMsgBuf(((unsigned long)canId.id) << 5, 3, buf);
-#if DEBUG
-  Serial.print(F("CAN msg: "));
-  for (int i = 0; i < 3; i++)                // Print each byte of the data
+  cbus_send<OPC_DSPD>(controllers.session[controllerIndex], speedDir);
+  dspdSent[controllerIndex] = { controllers.session[controllerIndex], speedDir, millis() };
+  dspdDirty &= ~(1UL << controllerIndex);
+}
+
+void cbus_dc_sessions::notifyDSPD(byte controllerIndex)
+{
+  dspdDirty |= (1UL << controllerIndex);
+}
+
+void cbus_dc_sessions::publishDSPD(void)
+{
+  unsigned long now = millis();
+  uint32_t pending;
+  byte controllerIndex;
+  byte speedDir;
+  if ((now - dspdBatchTime) < DSPD_BATCH_MS)
+  {
+    return;
+  }
+  dspdBatchTime = now;
+  // Controllers without a session have no cabs to tell
+  dspdDirty &= controllers.active;
+  pending = dspdDirty;
+  while (pending)
   {
-    Serial.print(F(" "));
-    if (buf[i] < 0x10)                     // If data byte is less than 0x10, add a leading zero
+    controllerIndex = __builtin_ctz(pending);
+    pending &= pending - 1;
+    speedDir = controllers.trainController[controllerIndex].getSpeed() | (controllers.trainController[controllerIndex].getDirection() * 0x80);
+    if ((speedDir == dspdSent[controllerIndex].speedDir) && (controllers.session[controllerIndex] == dspdSent[controllerIndex].session))
     {
-      Serial.print(F("0"));
+      // Nothing the cabs would see has changed
+      dspdDirty &= ~(1UL << controllerIndex);
     }
-    Serial.print(buf[i], HEX);
+    else if (((speedDir & 0x7f) <= 1) || ((now - dspdSent[controllerIndex].time) >= DSPD_MIN_INTERVAL_MS))
+    {
+      sendDSPD(controllerIndex);
+    }
+    // Otherwise it stays noted until the session may send again
   }
-  Serial.println();
-#endif
-
 }
 
 #if 0 // IB
@@ -744,7 +932,7 @@ void setupDisplay()
 #endif
 
     display.setCursor(x_pos, y_pos);
-    display.print(controllers[controllerIndex].DCCAddress); // display DCC address
+    display.print(controllers.DCCAddress[controllerIndex]); // display DCC address
  //   if (init)
 //    {
 //#if OLED_DISPLAY
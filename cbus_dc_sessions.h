@@ -21,6 +21,8 @@
 #include "dc_controller.h"
 #include "trainController.h"
 #include "throttle.h"
+#include "speed_curve.h"
+#include "cbus_dc_consists.h"
 
 #if SET_INERTIA_RATE
 #define INERTIA        3200       // Inertia counter value. Set High
@@ -41,6 +43,11 @@
 #define MAXTIMEOUT 30      // Max number of seconds before session is timed out
                            // if no stayalive received for the session
 
+#define CANCMD_RESPONSE_MS 500     // Time a CANCMD has to answer a cab before we work standalone
+
+#define DSPD_BATCH_MS        50    // Changed speeds are published together at this interval
+#define DSPD_MIN_INTERVAL_MS 250   // Least time between DSPDs for one session, except to report a stop
+
 enum class ErrorState : byte {
   blankError,
   noError,
@@ -63,37 +70,50 @@ enum class ErrorState : byte {
 
 // NOTE: controllers' index (not the DCC address) is used by the keypad handler. 
 // Making the last digit of the DCC address = the index aids clarity for user.
-struct {
-  int             session;
-  unsigned int    DCCAddress;
-  byte            longAddress;
-  byte            timeout;
-  boolean         shared;       // this loco shared by > 1 CAB (this includes the keypad)
-  struct {
-      byte      address;      // DCC short address of consist. 0 = unused.
-      byte      session;      // Session id of consist. 0 = unused.
-      boolean   reverse;
-  } consist;
-
-  trainControllerClass trainController;
-} controllers[NUM_CONTROLLERS] = {
-#if LINKSPRITE || TOWNSEND
-                // Values taken from the motor shield example code
-                {SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 1, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(pinI1, pinI2, pwmpins[0])}
-               ,{SF_INACTIVE, (startAddress * (deviceAddress + 1)) + 2, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(pinI3, pinI4, pwmpins[1])}
-#elseif CBUS
-                  {SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 1, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(22, 23, pwmpins[0])}
-                   ,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 2, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(24, 25, pwmpins[1])}
-                   ,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 3, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(26, 27, pwmpins[2])}
-                   ,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 4, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(28, 29, pwmpins[3])}
-                   ,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 5, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(30, 31, pwmpins[4])}
-                   ,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 6, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(32, 33, pwmpins[5])}
-                 //,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 7, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(14, 15, pwmpins[6])}
-                 //,{SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 8, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass(16, 17, pwmpins[7])}
-#else
-                {SF_INACTIVE, (startAddress * (deviceAddr + 1)) + 1, SF_LONG, 0, false, { 0, 0, false }, trainControllerClass()}
-#endif
-                                  };
+//
+// The controller table is held as structure of arrays. The session scans made on
+// every message and every loop only touch the hot arrays at the front, and the
+// active and shared flags are bit sets with a bit per controller.
+typedef struct {
+  byte      address;      // DCC short address of consist. 0 = unused.
+  byte      session;      // Session id of consist. 0 = unused.
+  boolean   reverse;
+} t_controller_consist;
+
+static_assert(NUM_CONTROLLERS <= 32, "controller bit sets are 32 bits");
+
+struct t_controllers {
+  // Hot - scanned for sessions and timeouts
+  int             session[NUM_CONTROLLERS];
+  byte            timeout[NUM_CONTROLLERS];
+  uint32_t        active;       // Bit set for each controller with a session
+  uint32_t        shared;       // this loco shared by > 1 CAB (this includes the keypad)
+  // Cold - addresses, consists and the output itself
+  unsigned int    DCCAddress[NUM_CONTROLLERS];
+  byte            longAddress[NUM_CONTROLLERS];
+  t_controller_consist consist[NUM_CONTROLLERS];
+  trainControllerClass trainController[NUM_CONTROLLERS];
+
+  t_controllers(void);
+  void setSession(byte controllerIndex, int newSession)
+  {
+    session[controllerIndex] = newSession;
+    if (newSession == SF_INACTIVE)
+      active &= ~(1UL << controllerIndex);
+    else
+      active |= (1UL << controllerIndex);
+  }
+  void setShared(byte controllerIndex, boolean isShared)
+  {
+    if (isShared)
+      shared |= (1UL << controllerIndex);
+    else
+      shared &= ~(1UL << controllerIndex);
+  }
+  boolean isShared(byte controllerIndex) { return (shared & (1UL << controllerIndex)) != 0; }
+};
+
+extern t_controllers controllers;
 
 #if ENCODER
 #if TOWNSEND
@@ -188,6 +208,21 @@ void keepaliveSession(byte session);
  */
 void locoRequest(unsigned int address, byte long_address, byte flags);
 
+/*
+ * A CANCMD has been seen on the bus
+ */
+void commandStationSeen(void);
+
+/*
+ * Take over session allocation if the CANCMD has not answered a request in time
+ */
+void checkCommandStation(void);
+
+/*
+ * Mark the sessions the controllers already hold as in use (after a warm start)
+ */
+void claimSessions(void);
+
 /*
 * A throttle has requested access to a particular consist address
 * This routine is only used if there is no CANCMD on the bus that will
@@ -207,8 +242,29 @@ void addSessionConsist(byte session, byte consist);
 
 void removeSessionConsist(byte session);
 
+/*
+ * Apply a DSPD for a consist session to every member on this module, in one pass.
+ * Returns false if there is no such consist here.
+ */
+bool setConsistSpeed(byte session, byte requestedSpeed);
+
+/*
+ * Rebuild the consist member lists from the controllers' consist settings
+ */
+void rebuildConsists(void);
+
 void setSpeedAndDirection(byte controllerIndex, byte requestedSpeed, byte reverse);
 
+/*
+ * Load the speed curve for each controller from its NVs (Vstart, Vmid, Vmax)
+ */
+void loadSpeedCurves(CBUSConfig &config);
+
+/*
+ * Load the motor characterisation for the loco on each controller's address
+ */
+void loadMotorProfiles(void);
+
 /**
  * Send an error packet labelled with the DCC address
  */
@@ -229,6 +285,11 @@ void sendReset();
 
 void emergencyStopAll();
 
+/**
+ * Report an output overload to the CABs of every active controller
+ */
+void reportOverload();
+
 
 /**
 * Stop all DC tracks
@@ -237,11 +298,27 @@ void emergencyStopAll();
 */
 void stopAll(boolean emergency);
 
+/**
+* Emergency stop every controller with its bit set in the mask
+*/
+void emergencyStopMask(uint32_t mask);
+
 /*
 * Send a DSPD message to CABs showing speed/direction
 */
 void sendDSPD(byte controllerIndex);
 
+/*
+* Note that a controller's speed or direction may have changed, for publishDSPD() to report
+*/
+void notifyDSPD(byte controllerIndex);
+
+/*
+* Called from loop(). Sends a DSPD for each noted controller whose speed or direction
+* differs from what its cabs were last told, batched and rate limited per session
+*/
+void publishDSPD(void);
+
 // N beeps
 void nBeeps (byte numBeeps);
 
@@ -0,0 +1,164 @@
+//
+//  cbus_dc_snapshot.cpp
+//
+//  Session state snapshot for the CBUS DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include "cbus_module_defs.h"
+#include "cbus_dc_sessions.h"
+#include "cbus_dc_snapshot.h"
+
+cbus_dc_snapshot::cbus_dc_snapshot(void)
+{
+  _open = false;
+}
+
+void cbus_dc_snapshot::begin(void)
+{
+  char name[8];
+  _open = _prefs.begin("dcsessions", false);
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    _last_write[controllerIndex] = 0;
+    key(controllerIndex, name);
+    if (!_open || (_prefs.getBytes(name, &_saved[controllerIndex], sizeof(t_session_record)) != sizeof(t_session_record)))
+    {
+      // Nothing stored yet, so anything captured will differ
+      memset(&_saved[controllerIndex], 0, sizeof(t_session_record));
+    }
+  }
+}
+
+byte cbus_dc_snapshot::checksum(const t_session_record *record)
+{
+  const byte *data = (const byte *)record;
+  byte sum = 0x5a;
+  for (byte i = 0; i < offsetof(t_session_record, checksum); i++)
+  {
+    sum = (sum << 1 | sum >> 7) ^ data[i];
+  }
+  return sum;
+}
+
+void cbus_dc_snapshot::key(byte controllerIndex, char *name)
+{
+  sprintf(name, "c%u", controllerIndex);
+}
+
+void cbus_dc_snapshot::capture(byte controllerIndex, t_session_record *record)
+{
+  memset(record, 0, sizeof(t_session_record));
+  record->version = SNAPSHOT_VERSION;
+  record->session = controllers.session[controllerIndex];
+  record->dcc_address = controllers.DCCAddress[controllerIndex];
+  record->long_address = controllers.longAddress[controllerIndex];
+  record->speed_dir = controllers.trainController[controllerIndex].getSpeed() | (controllers.trainController[controllerIndex].getDirection() ? 0x80 : 0);
+  record->consist_address = controllers.consist[controllerIndex].address;
+  record->consist_session = controllers.consist[controllerIndex].session;
+  record->consist_reverse = controllers.consist[controllerIndex].reverse;
+  record->checksum = checksum(record);
+}
+
+bool cbus_dc_snapshot::warmStartPossible(void)
+{
+  // After a power on the trains have stopped anyway, so only resume
+  // after resets the layout power will have ridden through.
+  switch (esp_reset_reason())
+  {
+    case ESP_RST_BROWNOUT:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+      return _open;
+    default:
+      return false;
+  }
+}
+
+byte cbus_dc_snapshot::restore(void)
+{
+  byte resumed = 0;
+  byte speed;
+  t_session_record *record;
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    record = &_saved[controllerIndex];
+    // Ignore anything stale, corrupt, or for a different address layout
+    if ((record->version != SNAPSHOT_VERSION) || (record->checksum != checksum(record)) ||
+        (record->dcc_address != controllers.DCCAddress[controllerIndex]) ||
+        (record->long_address != controllers.longAddress[controllerIndex]))
+    {
+      continue;
+    }
+    controllers.consist[controllerIndex].address = record->consist_address;
+    controllers.consist[controllerIndex].session = record->consist_session;
+    controllers.consist[controllerIndex].reverse = record->consist_reverse;
+    if (record->session == SF_INACTIVE)
+    {
+      continue;
+    }
+    controllers.setSession(controllerIndex, record->session);
+    // The cab must send a keep alive within MAXTIMEOUT, or the session is dropped as usual
+    controllers.timeout[controllerIndex] = 0;
+    // Output restarts from zero and is ramped back up by matchToTargets().
+    // A stored emergency stop (speed step 1) resumes as stopped.
+    speed = record->speed_dir & 0x7f;
+    if (speed == 1)
+    {
+      speed = 0;
+    }
+    controllers.trainController[controllerIndex].setSpeedAndDirection((record->speed_dir & 0x80) ? SF_FORWARDS : SF_REVERSE, speed);
+#if DEBUG
+    Serial << F("> Resumed session ") << record->session << F(" for address ") << record->dcc_address << F(" speed ") << speed << endl;
+#endif
+    resumed++;
+  }
+  return resumed;
+}
+
+void cbus_dc_snapshot::update(void)
+{
+  t_session_record record;
+  char name[8];
+  unsigned long now;
+  if (!_open)
+  {
+    return;
+  }
+  now = millis();
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    if ((now - _last_write[controllerIndex]) < SNAPSHOT_INTERVAL)
+    {
+      continue;
+    }
+    capture(controllerIndex, &record);
+    // Only changed records are written, to keep flash wear down
+    if (memcmp(&record, &_saved[controllerIndex], sizeof(t_session_record)) != 0)
+    {
+      key(controllerIndex, name);
+      _prefs.putBytes(name, &record, sizeof(t_session_record));
+      _saved[controllerIndex] = record;
+      _last_write[controllerIndex] = now;
+    }
+  }
+}
+
+void cbus_dc_snapshot::clear(void)
+{
+  if (_open)
+  {
+    _prefs.clear();
+  }
+  for (byte controllerIndex = 0; controllerIndex < NUM_CONTROLLERS; controllerIndex++)
+  {
+    memset(&_saved[controllerIndex], 0, sizeof(t_session_record));
+  }
+}
@@ -0,0 +1,63 @@
+//
+//  cbus_dc_snapshot.h
+//
+//  Session state snapshot for the CBUS DC controller.
+//
+//  Session, DCC address, speed, direction and consist for each controller are kept in NVS,
+//  one small record per controller, so that after a brown-out or watchdog reset the module
+//  can pick up its sessions again instead of waiting for every cab to re-acquire.
+//  Records are only rewritten when they change, and no more often than SNAPSHOT_INTERVAL.
+//  NVS spreads writes over its pages, which gives the wear levelling.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_dc_snapshot_h
+#define cbus_dc_snapshot_h
+
+#include <arduino.h>
+#include <Preferences.h>
+#include "cbus_module_defs.h"
+
+const unsigned long SNAPSHOT_INTERVAL = 2000;  // Minimum ms between writes of a controller record
+const byte SNAPSHOT_VERSION = 1;               // Bump if the record layout changes
+
+typedef struct
+{
+  byte     version;
+  int16_t  session;           // SF_INACTIVE if no session
+  uint16_t dcc_address;
+  byte     long_address;
+  byte     speed_dir;         // CBUS speed step, top bit set for forwards
+  byte     consist_address;
+  byte     consist_session;
+  byte     consist_reverse;
+  byte     checksum;
+} t_session_record;
+
+class cbus_dc_snapshot
+{
+  Preferences _prefs;
+  t_session_record _saved[NUM_CONTROLLERS];
+  unsigned long _last_write[NUM_CONTROLLERS];
+  bool _open;
+
+  void capture(byte controllerIndex, t_session_record *record);
+  byte checksum(const t_session_record *record);
+  void key(byte controllerIndex, char *name);
+
+public:
+  cbus_dc_snapshot(void);
+  void begin(void);
+  // True if the last reset was one the layout may not have noticed (brown-out, watchdog, panic)
+  bool warmStartPossible(void);
+  // Restore sessions from NVS, returns the number of sessions resumed
+  byte restore(void);
+  // Write any changed controller records, call from loop()
+  void update(void);
+  // Forget all stored sessions, e.g. after an ARST
+  void clear(void);
+};
+
+#endif
@@ -0,0 +1,66 @@
+//
+//  cbus_frame.h
+//
+//  CBUS frame builder for the CBUS DC controller.
+//
+//  The data length of a CBUS message is fixed by its opcode: the top three bits
+//  give the number of data bytes after the opcode. cbus_send<OPC>(...) takes the
+//  opcode as a template parameter, so a call with the wrong number of bytes fails
+//  to compile, and the bytes are written straight into the frame that is queued.
+//  Frames go out on the module's CBUS object with its current CAN ID.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef cbus_frame_h
+#define cbus_frame_h
+
+#include <arduino.h>
+#include <CBUSESP32.h>              // CAN controller and CBUS class
+#include <CBUSconfig.h>             // module configuration
+#include "cbus_dc_metrics.h"
+
+extern CBUSConfig config;           // module_config in the sketch
+extern CBUSESP32 CBUS;
+extern cbus_dc_metrics Metrics;
+
+const byte CBUS_FRAME_MAX_LEN = 8;
+
+// Length of a frame, opcode included, from the opcode
+constexpr byte cbus_opc_len(byte opc) { return (opc >> 5) + 1; }
+
+template <byte OPC, typename... Data>
+inline bool cbus_send(Data... data)
+{
+  static_assert(sizeof...(Data) + 1 == cbus_opc_len(OPC), "data bytes do not match the CBUS opcode length");
+  CANFrame msg;
+  byte *p = &msg.data[1];
+  (void)p;
+  msg.id = config.CANID;
+  msg.len = cbus_opc_len(OPC);
+  msg.ext = false;
+  msg.rtr = false;
+  msg.data[0] = OPC;
+  // Each data byte in order, the leading 0 allows for opcodes with no data
+  int expand[] = { 0, ((*p++ = (byte)data), 0)... };
+  (void)expand;
+  if (!CBUS.sendMessage(&msg))
+  {
+    Metrics.txFailed();
+    return false;
+  }
+  return true;
+}
+
+// An event from this node, node number and event number then any extra data bytes
+template <byte OPC, typename... Data>
+inline bool cbus_send_event(unsigned int eventNo, Data... data)
+{
+  return cbus_send<OPC>(highByte(config.nodeNum), lowByte(config.nodeNum), highByte(eventNo), lowByte(eventNo), data...);
+}
+
+// A frame whose opcode is only known at run time. Fails if len does not match the opcode.
+bool cbus_send_frame(byte len, const byte *buf);
+
+#endif
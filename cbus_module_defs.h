@@ -14,7 +14,18 @@
 const byte VER_MAJ = 4;                  // code major version
 const char VER_MIN = 'z';                // code minor version
 const byte VER_BETA = 14;                 // code beta sub-version
-const byte MODULE_ID = 99;               // CBUS module type
+const byte MODULE_ID = 100;              // CBUS module type
 const byte NUM_CONTROLLERS =1;
 
+// NV layout, the speed curves (see speed_curve.h) then the station stop (see brake_profile.h)
+const byte MODULE_NUM_NVS = 10;
+const byte NV_SPEED_CURVE_BASE = 1;        // Vstart, Vmid, Vmax for each controller in turn
+const byte NV_SPEED_CURVE_SIZE = 3;
+const byte NV_BRAKE_BASE = NV_SPEED_CURVE_BASE + (NUM_CONTROLLERS * NV_SPEED_CURVE_SIZE);
+const byte NV_BRAKE_DISTANCE = NV_BRAKE_BASE;       // Braking distance in cm, 0 to use NV_BRAKE_TIME
+const byte NV_BRAKE_TIME = NV_BRAKE_BASE + 1;       // Braking time in tenths of a second
+const byte NV_BRAKE_DWELL = NV_BRAKE_BASE + 2;      // Dwell time in seconds
+const byte NV_BRAKE_SCALE_SPEED = NV_BRAKE_BASE + 3;// Speed at full throttle in cm/s
+static_assert(NV_BRAKE_SCALE_SPEED <= MODULE_NUM_NVS, "NV layout does not fit in MODULE_NUM_NVS");
+
 #endif
@@ -22,7 +22,8 @@
 #include "dc_controller.h"
 #include "throttle.h"
                       
-void dc_controller::set_throttle(bool forward_not_backwards)
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::set_throttle(bool forward_not_backwards)
 {
   // Set both outputs to zero before setting/swapping
   throttle0.write_output(0);
@@ -55,8 +56,40 @@ void dc_controller::set_throttle(bool forward_not_backwards)
   return_throttle.clear_blanking();
 }
 
+// Cut both outputs through the blanking pins, used when overloaded
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::cut_output(void)
+{
+  output_throttle.set_blanking();
+  return_throttle.set_blanking();
+  output_throttle.write_output(0);
+  return_throttle.write_output(0);
+  _output_cut = true;
+}
+
+// Blanking and direction for the scope capture, blanking runs from the blanking phase to the end of the cycle
+template <class SpeedSource>
+byte dc_controller_core<SpeedSource>::scope_flags(int phase)
+{
+  byte flags = _direction ? SCOPE_FLAG_FORWARDS : 0;
+  if ((phase >= _cycle_blank_phase) || _output_cut)
+  {
+    flags |= SCOPE_FLAG_BLANKING;
+  }
+  if (phase == LAST_PHASE)
+  {
+    flags |= SCOPE_FLAG_BEMF_READ;
+  }
+  if (_output_cut)
+  {
+    flags |= SCOPE_FLAG_CUT;
+  }
+  return flags;
+}
+
 // Filter calculates instantaneous output value based on mode, and phase
-int dc_controller::filter_calc(t_wave_mode wave_mode, int phase, int throttle_level)
+template <class SpeedSource>
+int dc_controller_core<SpeedSource>::filter_calc(t_wave_mode wave_mode, int phase, int throttle_level)
 {
   long dc_offset;
   long switching_phase;
@@ -110,7 +143,8 @@ int dc_controller::filter_calc(t_wave_mode wave_mode, int phase, int throttle_le
 }
    
 // This calculates the overall throttle level based on the pot setting bemf measurement and selected mode    
-int dc_controller::calculate_throttle(t_wave_mode wave_mode, int requested_speed, int bemf_speed)
+template <class SpeedSource>
+int dc_controller_core<SpeedSource>::calculate_throttle(t_wave_mode wave_mode, int requested_speed, int bemf_speed)
 {
   long output_level;
   long error_correction;
@@ -119,9 +153,9 @@ int dc_controller::calculate_throttle(t_wave_mode wave_mode, int requested_speed
   // By default or if mode is direct, output = input
   // Input levels arefrom ADCs, 0..4095 range
   output_level=requested_speed;
-  if ((wave_mode == MODE_TRIANGLE) and (bemf_speed < MAX_BEMF_LEVEL))
+  if ((wave_mode == MODE_TRIANGLE_BEMF) and (bemf_speed < MAX_BEMF_LEVEL))
   {
-    error_correction = ((_last_bemf+bemf_speed)*ERROR_SCALE);
+    error_correction = motor_level(_last_bemf+bemf_speed);
     error_level = requested_speed-error_correction;
     scaled_error_level = int(error_level*(MAX_THROTTLE_LEVEL-requested_speed)/MAX_THROTTLE_LEVEL);
     if(error_level>=0)
@@ -146,12 +180,26 @@ int dc_controller::calculate_throttle(t_wave_mode wave_mode, int requested_speed
   return(output_level);
 }
 
-dc_controller::dc_controller(void)
+// Throttle level the motor should need to run at the speed given by the sum of two
+// BEMF readings, from its offset, gain and stiction
+template <class SpeedSource>
+long dc_controller_core<SpeedSource>::motor_level(int bemf_sum)
+{
+  long moving = bemf_sum - (2 * _motor.offset);
+  if (moving <= 0)
+  {
+    return 0;
+  }
+  return (_motor.stiction * 16L) + ((_motor.gain_q2 * moving) / 8);
+}
+
+template <class SpeedSource>
+dc_controller_core<SpeedSource>::dc_controller_core(void)
 { 
   // Assign pins
   pinMode(PIN_BLNK0, OUTPUT);
   pinMode(PIN_BLNK1, OUTPUT);
-  pinMode(PIN_DIR, INPUT_PULLUP);
+  _source.setup();
   pinMode(PIN_BEMF0, INPUT);
   pinMode(PIN_BEMF1, INPUT);
   
@@ -163,7 +211,26 @@ dc_controller::dc_controller(void)
   throttle0.initialise(DAC1, PIN_BEMF0, PIN_BLNK0);
   throttle1.initialise(DAC2, PIN_BEMF1, PIN_BLNK1);
 
-  _direction = digitalRead(PIN_DIR);
+  // Triangle wave with BEMF regulation unless changed
+  _wave_mode = MODE_TRIANGLE_BEMF;
+  _requested_level = 0;
+  _throttle_level = 0;
+  _bemf_level = 0;
+  _phase = 0;
+  _motor = MOTOR_DEFAULTS;
+  _output_cut = false;
+  _estop_us = 0;
+  _estop_report = false;
+  _last_tick_us = 0;
+  reset_stats();
+  _blank_adaptive = false;
+  _blank_ticks = BLANK_TICKS_MIN;
+  _cycle_blank_phase = BLANK_PHASE;
+  _blank_cycles = 0;
+  _blank_probe = false;
+  memset(_decay, 0, sizeof(_decay));
+
+  _direction = _source.forwards();
   set_throttle(_direction);
   _last_direction = _direction;
 
@@ -174,83 +241,281 @@ dc_controller::dc_controller(void)
         
 
     
-void dc_controller::update()
+// One whole waveform cycle, blocking for MAX_PHASE ticks
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::update()
 {
-  int i;
-  //only act on direction switch when requested_level is below minimum threshold
-  // Note that there is no debounce.
-  if (_requested_level < MIN_REQUESTED_LEVEL)
+  do
   {
-    _direction = digitalRead(PIN_DIR);
+    tick();
+    delay(1);
   }
-  else
-  {
-    _direction = _last_direction;
-  }
-                
-  if (_direction == _last_direction)
+  while (_phase != 0);
+}
+
+// One waveform tick, to be called every 1ms.
+// Direction is only changed at the start of a cycle. The tick that changes it does nothing
+// else, so the cycle starts one tick later.
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::tick()
+{
+  if (_phase == 0)
   {
-    for (i=0;i<MAX_PHASE;i++) 
+    //only act on direction switch when requested_level is below minimum threshold
+    // A pot source debounces the switch in its input conditioner.
+    if (_requested_level < MIN_REQUESTED_LEVEL)
     {
-      wave(i);
-      delay(1);
+      // Throttle turned to zero, so allow the output back on after an overload
+      _protection.rearm();
+      _direction = _source.forwards();
+    }
+    else
+    {
+      _direction = _last_direction;
+    }
+
+    if (_direction != _last_direction)
+    {
+      // Otherwise reverse direction
+      _last_direction = _direction;                
+      set_throttle(_direction);
+      return;
     }
   }
-  else
+  note_tick();
+  wave(_phase);
+  _phase++;
+  if (_phase >= MAX_PHASE)
   {
-    // Otherwise reverse direction
-    _last_direction = _direction;                
-    set_throttle(_direction);
+    _phase = 0;
   }
 }
 
 //
 // wave() - runs every tick (assume 1ms for now) 
 //   
-void dc_controller::wave(int _phase)
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::wave(int _phase)
 {
   // Perform required actions on particular phases
   // Start all cycles with blanking off on both throttles
   byte _output_sample;
-  int _throttle_value;
+  // Overload protection comes first on every tick, and holds both outputs off while tripped
+  if (_protection.tick())
+  {
+    cut_output();
+    _scope.record(_phase, 0, _bemf_level, _requested_level, scope_flags(_phase));
+    return;
+  }
+  if (_output_cut)
+  {
+    // Recovered from an overload, blanking on the output is put back at phase 0 as usual
+    return_throttle.clear_blanking();
+    _output_cut = false;
+  }
   if (_phase == 0)
   {
     output_throttle.clear_blanking();
+    start_blanking_cycle();
   }  
   else if (_phase == POT_PHASE)
   {
-    #ifdef CBUS
-    ;
-    #else
-    _requested_level = analogRead(PIN_POT);
-    #endif
+    // A calibration sweep takes over from the speed source while it runs
+    _requested_level = _calibration.active() ? _calibration.level() : _source.level();
   }
-  else if (_phase == BLANK_PHASE)
+  else if (_phase == _cycle_blank_phase)
   {
     output_throttle.set_blanking();
+    if (_blank_probe)
+    {
+      _decay[0] = output_throttle.read_bemf();
+    }
+  }
+  else if (_blank_probe && (_phase > _cycle_blank_phase) && (_phase < LAST_PHASE))
+  {
+    // Measuring the decay, read the BEMF on every blanked tick
+    _decay[_phase - _cycle_blank_phase] = output_throttle.read_bemf();
   }
   // At end of each cycle recalculate throttle values
   else if (_phase == LAST_PHASE)
   {
     _bemf_level= output_throttle.read_bemf();                
+    _calibration.bemf(_bemf_level);
+    if (_blank_probe)
+    {
+      _decay[LAST_PHASE - _cycle_blank_phase] = _bemf_level;
+      adapt_blanking();
+    }
+    if (_bemf_level < _bemf_min) _bemf_min = _bemf_level;
+    if (_bemf_level > _bemf_max) _bemf_max = _bemf_level;
     
-    _throttle_value = calculate_throttle(MODE_TRIANGLE,_requested_level,_bemf_level);
+    // Any station stop in progress scales the requested level down along its braking curve
+    // No regulation while calibrating, the sweep measures the unregulated motor
+    _throttle_level = calculate_throttle(_calibration.active() ? MODE_TRIANGLE : _wave_mode,_brake.apply(_requested_level),_bemf_level);
+    if (_protection.signature(_throttle_level, _bemf_level))
+    {
+      cut_output();
+      _scope.record(_phase, 0, _bemf_level, _requested_level, scope_flags(_phase));
+      return;
+    }
   }
   // Regardless of above actions set output value
   // Note that output will only be seen when blanking is not enabled
-  _output_sample=filter_calc(MODE_TRIANGLE,_phase,_throttle_value);
+  _output_sample=filter_calc(_wave_mode,_phase,_throttle_level);
   output_throttle.write_output(_output_sample);
   return_throttle.write_output(0);
+  _scope.record(_phase, _output_sample, _bemf_level, _requested_level, scope_flags(_phase));
   //_phase++;
   //if (_phase >= MAX_PHASE)
     //_phase = 0;
 }
 
-#ifdef CBUSDAC
-void setSpeedAndDirection(int speed, bool direction)
+// Select output waveform, and whether BEMF regulation is used
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::set_wave_mode(t_wave_mode wave_mode)
+{
+  _wave_mode = wave_mode;
+}
+
+// Station stop settings, distance in cm (0 to stop by time), brake time in tenths of a second,
+// dwell in seconds and speed at full throttle in cm/s
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::configure_station_stop(unsigned int distance_cm, unsigned int brake_ds, unsigned int dwell_s, unsigned int scale_speed_cms)
+{
+  _brake.configure(distance_cm, brake_ds, dwell_s, scale_speed_cms);
+}
+
+// Brake to a stop, dwell, then restart. Ignored if a stop is already in progress.
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::station_stop(void)
+{
+  if (!_brake.active())
+  {
+    _brake.start(_requested_level);
+  }
+}
+
+// True once for each overload trip, so it can be reported
+template <class SpeedSource>
+bool dc_controller_core<SpeedSource>::overload_report(void)
+{
+  return _protection.take_report();
+}
+
+// Force an overload trip, to check the reaction time
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::inject_overload(void)
+{
+  _protection.inject();
+}
+
+// Time from the last injected overload to the output being cut
+template <class SpeedSource>
+unsigned long dc_controller_core<SpeedSource>::overload_reaction_us(void)
+{
+  return _protection.reaction_us();
+}
+
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::emergency_stop(unsigned long since_us)
+{
+  // Outputs first, then make sure the next wave cycle does not put them back
+  cut_output();
+  _requested_level = 0;
+  _throttle_level = 0;
+  _source.stop();
+  _calibration.abort();
+  _brake.cancel();
+  _estop_us = micros() - since_us;
+  _estop_report = true;
+}
+
+// Count ticks that start late, including any gap between calls of update()
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::note_tick(void)
+{
+  unsigned long now = micros();
+  if ((_last_tick_us != 0) && ((now - _last_tick_us) > WAVE_OVERRUN_US))
+  {
+    _tick_overruns++;
+  }
+  _last_tick_us = now;
+}
+
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::reset_stats(void)
+{
+  _tick_overruns = 0;
+  _bemf_min = INT_MAX;
+  _bemf_max = 0;
+}
+
+// Pick the blanking phase for the cycle starting, the longest window when it is time to probe the decay
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::start_blanking_cycle(void)
+{
+  _blank_probe = false;
+  if (_blank_adaptive && (++_blank_cycles >= BLANK_PROBE_CYCLES))
+  {
+    _blank_cycles = 0;
+    _blank_probe = true;
+    _cycle_blank_phase = LAST_PHASE - BLANK_TICKS_MAX;
+  }
+  else
+  {
+    _cycle_blank_phase = LAST_PHASE - _blank_ticks;
+  }
+}
+
+// Find the first tick after which every reading of the probe is within BLANK_SETTLED_DELTA
+// of the last, and move the window one tick towards it. One tick at a time rides out a
+// noisy probe, and a window that is too short is put right within a few probes.
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::adapt_blanking(void)
+{
+  int settled = BLANK_TICKS_MAX;
+  int last = _decay[BLANK_TICKS_MAX];
+  if ((last < BLANK_MIN_BEMF) || _calibration.active())
+  {
+    return;
+  }
+  while ((settled > BLANK_TICKS_MIN) && (abs(_decay[settled - 1] - last) <= BLANK_SETTLED_DELTA))
+  {
+    settled--;
+  }
+  if (settled > _blank_ticks)
+  {
+    _blank_ticks++;
+  }
+  else if (settled < _blank_ticks)
+  {
+    _blank_ticks--;
+  }
+}
+
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::set_blanking_window(int ticks)
+{
+  _blank_adaptive = false;
+  _blank_ticks = constrain(ticks, BLANK_TICKS_MIN, BLANK_TICKS_MAX);
+}
+
+template <class SpeedSource>
+void dc_controller_core<SpeedSource>::set_adaptive_blanking(bool adaptive)
+{
+  _blank_adaptive = adaptive;
+  _blank_cycles = 0;
+}
+
+template <class SpeedSource>
+bool dc_controller_core<SpeedSource>::estop_report(void)
 {
-  forwards_not_bacwards = direction'
-  _requested_level = speed;
+  bool report = _estop_report;
+  _estop_report = false;
+  return report;
 }
-#endif
 
+// The cores used by the sketches, see dc_controller.h
+template class dc_controller_core<pot_speed_source>;
+template class dc_controller_core<cbus_speed_source>;
+template class dc_controller_core<scripted_speed_source>;
@@ -14,37 +14,111 @@
 #ifndef dc_controller_h
 #define dc_controller_h
 
+#include "dc_controller_defs.h"
 #include "throttle.h"
-              
-class dc_controller 
+#include "brake_profile.h"
+#include "overload_protection.h"
+#include "scope_capture.h"
+#include "speed_source.h"
+#include "motor_profile.h"
+
+// The controller core, with the source of the requested speed and direction
+// fixed at compile time, see speed_source.h
+template <class SpeedSource>
+class dc_controller_core
 {
   int _last_bemf;
-  bool forwards_not_backwards;
   bool _direction;
   bool _last_direction;
   int _requested_level;
+  int _throttle_level;
   int _bemf_level;
   bool _blanking_enabled;
   int _phase;
+  t_wave_mode _wave_mode;
   throttle throttle0;
   throttle throttle1;
   throttle output_throttle;
   throttle return_throttle; 
+  brake_profile _brake;
+  overload_protection _protection;
+  bool _output_cut;
+  unsigned long _estop_us;
+  bool _estop_report;
+  scope_capture _scope;
+  SpeedSource _source;
+  t_motor_params _motor;
+  motor_calibration _calibration;
+  // Runtime statistics, read by the metrics registry
+  unsigned long _last_tick_us;
+  unsigned long _tick_overruns;
+  int _bemf_min;
+  int _bemf_max;
+  // Blanking window, _cycle_blank_phase is the one in use this cycle
+  bool _blank_adaptive;
+  int _blank_ticks;
+  int _cycle_blank_phase;
+  int _blank_cycles;
+  bool _blank_probe;
+  int _decay[BLANK_TICKS_MAX + 1];
 
   void set_throttle(bool forward_not_backwards);
+  void cut_output(void);
+  byte scope_flags(int phase);
+  void note_tick(void);
   int filter_calc(t_wave_mode wave_mode, int phase, int throttle_level);
   int calculate_throttle(t_wave_mode wave_mode, int requested_speed, int bemf_speed);
+  long motor_level(int bemf_sum);
+  void start_blanking_cycle(void);
+  void adapt_blanking(void);
 
 public:  
-  dc_controller(void);
+  dc_controller_core(void);
   void setup(void);
   void update(void);
-#ifdef CBUSDAC
-  void setSpeedAndDirection(int speed, bool direction);
-#endif
+  void tick(void);
+  // Sample the speed source, called every INPUT_SAMPLE_MS
+  void sample_inputs(void) { _source.sample(); }
+  SpeedSource &source(void) { return _source; }
   void wave(int _phase);
+  void set_wave_mode(t_wave_mode wave_mode);
+  void configure_station_stop(unsigned int distance_cm, unsigned int brake_ds, unsigned int dwell_s, unsigned int scale_speed_cms);
+  void station_stop(void);
+  bool overload_report(void);
+  void inject_overload(void);
+  unsigned long overload_reaction_us(void);
+  // Emergency stop fast lane. since_us is when the frame started being handled,
+  // so the time to cut the outputs can be reported
+  void emergency_stop(unsigned long since_us);
+  bool estop_report(void);
+  unsigned long estop_latency_us(void) { return _estop_us; }
+  // Waveform capture, recorded on every tick while armed
+  scope_capture &scope(void) { return _scope; }
+  unsigned long tick_overruns(void) { return _tick_overruns; }
+  int bemf_min(void) { return _bemf_min; }
+  int bemf_max(void) { return _bemf_max; }
+  void reset_stats(void);
+  // Motor characterisation used by BEMF regulation, and the sweep that measures it
+  void set_motor_params(const t_motor_params &params) { _motor = params; }
+  const t_motor_params &motor_params(void) { return _motor; }
+  void start_calibration(void) { _calibration.start(); }
+  motor_calibration &calibration(void) { return _calibration; }
+  // Blanking window in ticks before the BEMF reading, fixed or sized from the measured decay
+  void set_blanking_window(int ticks);
+  void set_adaptive_blanking(bool adaptive);
+  bool adaptive_blanking(void) { return _blank_adaptive; }
+  int blanking_window(void) { return _blank_ticks; }
+  // BEMF on each tick after blanking from the last probe, index 0 straight after blanking
+  int decay_sample(int ticks) { return _decay[ticks]; }
 };       
 
+// The CBUS build, speed from the sessions
+typedef dc_controller_core<cbus_speed_source> dc_controller;
+// The standalone build, speed from the pot
+typedef dc_controller_core<pot_speed_source> pot_dc_controller;
+// Test and benchmark runs, speed from a script
+typedef dc_controller_core<scripted_speed_source> scripted_dc_controller;
+
 #endif
 
 
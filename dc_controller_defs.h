@@ -21,6 +21,23 @@ const int MAX_PHASE = 16;
 const int POT_PHASE = 3;
 const int BLANK_PHASE = 14;
 const int LAST_PHASE = 15;
+// Blanking runs from the blanking phase to the BEMF reading at LAST_PHASE, BLANK_PHASE is the
+// shortest window. Adaptive blanking measures the decay after blanking every BLANK_PROBE_CYCLES
+// with the longest window, and moves the window one tick at a time towards the shortest one
+// whose readings are all within BLANK_SETTLED_DELTA of the last
+const int BLANK_TICKS_MIN = LAST_PHASE - BLANK_PHASE;
+const int BLANK_TICKS_MAX = 4;
+const int BLANK_PROBE_CYCLES = 64;
+const int BLANK_SETTLED_DELTA = 24;
+const int BLANK_MIN_BEMF = 64;         // Too little BEMF to see the decay, the window is left alone
+
+// Waveform ticks are 1ms apart, a gap longer than this is counted as an overrun
+const unsigned long WAVE_OVERRUN_US = 1500;
+
+// Fault codes flashed on the status LED, and how long they are shown for
+const byte FAULT_OVERLOAD = 1;
+const byte FAULT_ESTOP = 2;
+const unsigned long FAULT_SHOW_MS = 10000;
 
 // Levels and scale factors
 const int MIN_REQUESTED_LEVEL = 10;
@@ -0,0 +1,95 @@
+//
+//  input_conditioner.cpp
+//
+//  Conditioning of the speed pot and direction switch for the standalone DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "input_conditioner.h"
+#include "adc_calibration.h"
+
+extern adc_calibration AdcCal;
+
+input_conditioner::input_conditioner(void)
+{
+  _pot_pin = 0;
+  _dir_pin = 0;
+  _smoothed = 0;
+  _level = 0;
+  _forwards = true;
+  _dir_state = DIR_STEADY;
+  _dir_count = 0;
+}
+
+void input_conditioner::setup(byte pot_pin, byte dir_pin)
+{
+  _pot_pin = pot_pin;
+  _dir_pin = dir_pin;
+  pinMode(_dir_pin, INPUT_PULLUP);
+  // Start from where the inputs are, rather than ramping up from zero
+  _smoothed = (long)read_pot() << POT_SMOOTHING_SHIFT;
+  _level = read_pot();
+  _forwards = digitalRead(_dir_pin);
+}
+
+int input_conditioner::read_pot(void)
+{
+  long total = 0;
+  for (byte i = 0; i < INPUT_OVERSAMPLE; i++)
+  {
+    total += AdcCal.read(_pot_pin);
+  }
+  return (int)(total / INPUT_OVERSAMPLE);
+}
+
+void input_conditioner::sample(void)
+{
+  int smoothed;
+  bool forwards;
+
+  // Pot, averaged then smoothed, with hysteresis
+  _smoothed += read_pot() - (_smoothed >> POT_SMOOTHING_SHIFT);
+  smoothed = (int)(_smoothed >> POT_SMOOTHING_SHIFT);
+  if (smoothed < POT_HYSTERESIS)
+  {
+    _level = 0;
+  }
+  else if (smoothed > (MAX_THROTTLE_LEVEL - POT_HYSTERESIS))
+  {
+    _level = MAX_THROTTLE_LEVEL;
+  }
+  else if (abs(smoothed - _level) > POT_HYSTERESIS)
+  {
+    _level = smoothed;
+  }
+
+  // Direction switch, debounced
+  forwards = digitalRead(_dir_pin);
+  switch (_dir_state)
+  {
+    case DIR_STEADY:
+      if (forwards != _forwards)
+      {
+        _dir_state = DIR_CHANGING;
+        _dir_count = 1;
+      }
+      break;
+
+    case DIR_CHANGING:
+      if (forwards == _forwards)
+      {
+        // Bounced back
+        _dir_state = DIR_STEADY;
+      }
+      else if (++_dir_count >= DIR_DEBOUNCE_SAMPLES)
+      {
+        _forwards = forwards;
+        _dir_state = DIR_STEADY;
+      }
+      break;
+  }
+}
@@ -0,0 +1,58 @@
+//
+//  input_conditioner.h
+//
+//  Conditioning of the speed pot and direction switch for the standalone DC controller.
+//
+//  Inputs are sampled from a scheduled task every INPUT_SAMPLE_MS, not in the waveform
+//  phases, and the waveform picks up the conditioned values.
+//  The pot is read INPUT_OVERSAMPLE times and averaged, smoothed, then only passed on
+//  once it has moved by more than POT_HYSTERESIS, so the requested level does not
+//  jitter with ADC noise. Readings near either end snap to the end, so zero and full
+//  speed can still be reached.
+//  The direction switch has to read the same for DIR_DEBOUNCE_SAMPLES samples in a row
+//  before a change is accepted, and any bounce back restarts the count.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef input_conditioner_h
+#define input_conditioner_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+
+const unsigned long INPUT_SAMPLE_MS = 5;
+const byte INPUT_OVERSAMPLE = 8;           // ADC reads averaged for each sample
+const byte POT_SMOOTHING_SHIFT = 2;        // Each sample moves the smoothed level a quarter of the way
+const int POT_HYSTERESIS = 24;             // Movement needed before the level changes
+const byte DIR_DEBOUNCE_SAMPLES = 6;       // 30ms steady before a direction change is taken
+
+typedef enum
+{
+  DIR_STEADY,
+  DIR_CHANGING,                            // Switch differs from the accepted direction
+} t_direction_state;
+
+class input_conditioner
+{
+  byte _pot_pin;
+  byte _dir_pin;
+  long _smoothed;                          // Smoothed pot reading, scaled by 1 << POT_SMOOTHING_SHIFT
+  int _level;
+  bool _forwards;
+  t_direction_state _dir_state;
+  byte _dir_count;
+
+  int read_pot(void);
+
+public:
+  input_conditioner(void);
+  void setup(byte pot_pin, byte dir_pin);
+  // Called every INPUT_SAMPLE_MS
+  void sample(void);
+  int level(void) { return _level; }
+  bool forwards(void) { return _forwards; }
+};
+
+#endif
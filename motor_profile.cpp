@@ -0,0 +1,156 @@
+//
+//  motor_profile.cpp
+//
+//  Per loco motor characterisation for BEMF regulation.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include <Preferences.h>
+#include "dc_controller_defs.h"
+#include "motor_profile.h"
+
+motor_calibration::motor_calibration(void)
+{
+  _state = CAL_IDLE;
+  _step = 0;
+  _step_start = 0;
+  _result = MOTOR_DEFAULTS;
+}
+
+void motor_calibration::start(void)
+{
+  memset(_bemf_total, 0, sizeof(_bemf_total));
+  memset(_bemf_count, 0, sizeof(_bemf_count));
+  _step = 0;
+  _step_start = millis();
+  _state = CAL_RUNNING;
+}
+
+void motor_calibration::abort(void)
+{
+  if (_state == CAL_RUNNING)
+  {
+    _state = CAL_FAILED;
+  }
+}
+
+void motor_calibration::bemf(int bemf_level)
+{
+  unsigned long held;
+  if (_state != CAL_RUNNING)
+  {
+    return;
+  }
+  held = millis() - _step_start;
+  if (held < CAL_SETTLE_MS)
+  {
+    return;
+  }
+  if (held < (CAL_SETTLE_MS + CAL_MEASURE_MS))
+  {
+    _bemf_total[_step] += bemf_level;
+    _bemf_count[_step]++;
+    return;
+  }
+  // On to the next level, or finished
+  _step++;
+  _step_start = millis();
+  if (_step >= CAL_STEPS)
+  {
+    _step = 0;
+    fit();
+  }
+}
+
+int motor_calibration::step_bemf(byte step)
+{
+  if ((step >= CAL_STEPS) || (_bemf_count[step] == 0))
+  {
+    return 0;
+  }
+  return (int)(_bemf_total[step] / _bemf_count[step]);
+}
+
+// Offset from the stopped reading, stiction from the first level that turns the motor,
+// and gain as the least squares slope of throttle level against BEMF above that
+void motor_calibration::fit(void)
+{
+  int offset = step_bemf(0);
+  int stiction = -1;
+  float sum_xy = 0.0;
+  float sum_xx = 0.0;
+  float x;
+  float gain;
+  for (byte step = 1; step < CAL_STEPS; step++)
+  {
+    x = step_bemf(step) - offset;
+    if (x < CAL_MOVING_BEMF)
+    {
+      continue;
+    }
+    if (stiction < 0)
+    {
+      // Motor starts turning somewhere between the last level and this one
+      stiction = step_level(step - 1);
+    }
+    sum_xy += x * (step_level(step) - stiction);
+    sum_xx += x * x;
+  }
+  if ((stiction < 0) || (sum_xx <= 0.0))
+  {
+    _state = CAL_FAILED;
+    return;
+  }
+  gain = (4.0 * sum_xy) / sum_xx;
+  _result.offset = constrain(offset, 0, 255);
+  _result.gain_q2 = constrain((int)(gain + 0.5), 1, 255);
+  _result.stiction = constrain(stiction / 16, 0, 255);
+  _state = CAL_DONE;
+}
+
+motor_profiles::motor_profiles(void)
+{
+  _open = false;
+}
+
+void motor_profiles::begin(void)
+{
+  _open = _prefs.begin("dcmotors", false);
+}
+
+void motor_profiles::key(unsigned int address, char *name)
+{
+  snprintf(name, 8, "m%u", address);
+}
+
+t_motor_params motor_profiles::load(unsigned int address)
+{
+  t_motor_params params = MOTOR_DEFAULTS;
+  char name[8];
+  key(address, name);
+  if (!_open || (_prefs.getBytes(name, &params, sizeof(params)) != sizeof(params)))
+  {
+    return MOTOR_DEFAULTS;
+  }
+  return params;
+}
+
+bool motor_profiles::save(unsigned int address, const t_motor_params &params)
+{
+  char name[8];
+  key(address, name);
+  return _open && (_prefs.putBytes(name, &params, sizeof(params)) == sizeof(params));
+}
+
+void motor_profiles::forget(unsigned int address)
+{
+  char name[8];
+  key(address, name);
+  if (_open)
+  {
+    _prefs.remove(name);
+  }
+}
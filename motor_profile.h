@@ -0,0 +1,99 @@
+//
+//  motor_profile.h
+//
+//  Per loco motor characterisation for BEMF regulation.
+//
+//  A motor is described by three bytes:
+//    offset    BEMF reading with the motor stopped
+//    gain      throttle level per count of BEMF above the offset, in quarters
+//    stiction  throttle level below which the motor does not turn, in 16ths of full scale
+//  calculate_throttle() takes the throttle level a motor should need to run at the
+//  measured BEMF as offset/gain/stiction predict, and corrects towards the requested level.
+//  The defaults give the hand tuned ERROR_SCALE behaviour.
+//
+//  motor_calibration runs a loco through a sweep of throttle levels, with no regulation,
+//  holds each level for CAL_SETTLE_MS then averages the BEMF over CAL_MEASURE_MS, and
+//  fits the three parameters to the results. The loco must be free to run (a rolling
+//  road is best) as the sweep goes up to CAL_MAX_LEVEL.
+//  motor_profiles keeps the results in NVS by DCC address.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef motor_profile_h
+#define motor_profile_h
+
+#include <arduino.h>
+#include <Preferences.h>
+#include "dc_controller_defs.h"
+
+typedef struct
+{
+  byte offset;
+  byte gain_q2;                              // Throttle levels per BEMF count, times 4
+  byte stiction;                             // Throttle level / 16
+} t_motor_params;
+
+// Two BEMF readings times ERROR_SCALE, as calculate_throttle has always used
+const t_motor_params MOTOR_DEFAULTS = { 0, (byte)(2 * ERROR_SCALE * 4), 0 };
+
+const byte CAL_STEPS = 16;
+const int CAL_MAX_LEVEL = (MAX_THROTTLE_LEVEL * 3) / 4;
+const unsigned long CAL_SETTLE_MS = 400;
+const unsigned long CAL_MEASURE_MS = 400;
+const int CAL_MOVING_BEMF = 8;               // BEMF above the offset that shows the motor is turning
+
+typedef enum
+{
+  CAL_IDLE,
+  CAL_RUNNING,
+  CAL_DONE,
+  CAL_FAILED,                                // Aborted, or the motor never turned
+} t_cal_state;
+
+class motor_calibration
+{
+  t_cal_state _state;
+  byte _step;
+  unsigned long _step_start;
+  long _bemf_total[CAL_STEPS];
+  unsigned int _bemf_count[CAL_STEPS];
+  t_motor_params _result;
+
+  int step_level(byte step) { return ((long)step * CAL_MAX_LEVEL) / (CAL_STEPS - 1); }
+  void fit(void);
+
+public:
+  motor_calibration(void);
+  void start(void);
+  void abort(void);
+  bool active(void) { return (_state == CAL_RUNNING); }
+  t_cal_state state(void) { return _state; }
+  // Throttle level to drive while running
+  int level(void) { return active() ? step_level(_step) : 0; }
+  // Called with each BEMF reading while running
+  void bemf(int bemf_level);
+  const t_motor_params &result(void) { return _result; }
+  // Average BEMF measured at a step, for printing
+  int step_bemf(byte step);
+  int step_throttle(byte step) { return step_level(step); }
+};
+
+class motor_profiles
+{
+  Preferences _prefs;
+  bool _open;
+
+  void key(unsigned int address, char *name);
+
+public:
+  motor_profiles(void);
+  void begin(void);
+  // Defaults if nothing is stored for the address
+  t_motor_params load(unsigned int address);
+  bool save(unsigned int address, const t_motor_params &params);
+  void forget(unsigned int address);
+};
+
+#endif
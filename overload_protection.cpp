@@ -0,0 +1,134 @@
+//
+//  overload_protection.cpp
+//
+//  Overcurrent and short circuit protection for the DC controller.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "pindefs_dc_controller_esp32.h"
+#include "overload_protection.h"
+
+overload_protection::overload_protection(void)
+{
+  if (PIN_ISENSE != 0)
+  {
+    pinMode(PIN_ISENSE, INPUT);
+  }
+  _tripped = false;
+  _latched = false;
+  _report = false;
+  _inject = false;
+  _retries = 0;
+  _signature_count = 0;
+  _backoff = OVERLOAD_RETRY_TICKS;
+  _wait = 0;
+  _healthy = 0;
+  _reaction_us = 0;
+}
+
+void overload_protection::trip(void)
+{
+  _tripped = true;
+  _report = true;
+  _signature_count = 0;
+  _healthy = 0;
+  if (_retries < OVERLOAD_MAX_RETRIES)
+  {
+    _retries++;
+    _wait = _backoff;
+    _backoff = min((unsigned int)(_backoff * 2), OVERLOAD_MAX_BACKOFF);
+  }
+  else
+  {
+    // Too many in a row, stay off until rearmed
+    _latched = true;
+  }
+}
+
+bool overload_protection::tick(void)
+{
+  if (_tripped)
+  {
+    if (_latched)
+    {
+      return true;
+    }
+    if (_wait > 0)
+    {
+      _wait--;
+      return true;
+    }
+    // Retry, the next sample decides if the fault has gone
+    _tripped = false;
+  }
+  if (_inject || ((PIN_ISENSE != 0) && (analogRead(PIN_ISENSE) > OVERLOAD_CURRENT_LEVEL)))
+  {
+    trip();
+    if (_inject)
+    {
+      _reaction_us = micros() - _inject_us;
+      _inject = false;
+    }
+    return true;
+  }
+  if (_healthy < OVERLOAD_CLEAR_TICKS)
+  {
+    _healthy++;
+  }
+  else
+  {
+    _retries = 0;
+    _backoff = OVERLOAD_RETRY_TICKS;
+  }
+  return false;
+}
+
+bool overload_protection::signature(int throttle_level, int bemf_level)
+{
+  // A stalled loco looks the same, so only use this when there is no current sense
+  if (PIN_ISENSE != 0)
+  {
+    return false;
+  }
+  if ((throttle_level > OVERLOAD_SIGNATURE_LEVEL) && (bemf_level < OVERLOAD_SIGNATURE_BEMF))
+  {
+    if (++_signature_count >= OVERLOAD_SIGNATURE_CYCLES)
+    {
+      trip();
+      return true;
+    }
+  }
+  else
+  {
+    _signature_count = 0;
+  }
+  return false;
+}
+
+void overload_protection::rearm(void)
+{
+  if (_latched)
+  {
+    _latched = false;
+    _tripped = false;
+    _retries = 0;
+    _backoff = OVERLOAD_RETRY_TICKS;
+  }
+}
+
+bool overload_protection::take_report(void)
+{
+  bool report = _report;
+  _report = false;
+  return report;
+}
+
+void overload_protection::inject(void)
+{
+  _inject_us = micros();
+  _inject = true;
+}
@@ -0,0 +1,63 @@
+//
+//  overload_protection.h
+//
+//  Overcurrent and short circuit protection for the DC controller.
+//
+//  Checked on every waveform tick, before anything is written to the outputs.
+//  A current sense reading over OVERLOAD_CURRENT_LEVEL trips on that tick. Without a current
+//  sense input, a high drive level with next to no BEMF for several cycles is taken as a short.
+//  Once tripped the outputs are held off until a retry, with the wait doubling on each
+//  consecutive trip, and after OVERLOAD_MAX_RETRIES it stays off until rearmed.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef overload_protection_h
+#define overload_protection_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+
+const int OVERLOAD_CURRENT_LEVEL = 3000;                  // Current sense ADC reading that trips the output
+const int OVERLOAD_SIGNATURE_LEVEL = MAX_THROTTLE_LEVEL/2; // Drive level above which BEMF is expected
+const int OVERLOAD_SIGNATURE_BEMF = 20;                   // BEMF below this at that drive level looks like a short
+const byte OVERLOAD_SIGNATURE_CYCLES = 8;                 // Consecutive cycles of that before tripping
+const unsigned int OVERLOAD_RETRY_TICKS = 100;            // First retry after this many ticks
+const unsigned int OVERLOAD_MAX_BACKOFF = 6400;           // Longest wait between retries, ticks
+const byte OVERLOAD_MAX_RETRIES = 8;                      // Consecutive trips before latching off
+const unsigned int OVERLOAD_CLEAR_TICKS = 5000;           // Running this long without a trip clears the retry count
+
+class overload_protection
+{
+  bool _tripped;
+  bool _latched;
+  bool _report;
+  bool _inject;
+  byte _retries;
+  byte _signature_count;
+  unsigned int _backoff;
+  unsigned int _wait;
+  unsigned int _healthy;
+  unsigned long _inject_us;
+  unsigned long _reaction_us;
+
+  void trip(void);
+
+public:
+  overload_protection(void);
+  // Every tick, returns true if the output must be held off
+  bool tick(void);
+  // Once per cycle, with the drive level and BEMF just measured, returns true if this trips
+  bool signature(int throttle_level, int bemf_level);
+  // Clear a latched trip, e.g. when the throttle is turned to zero
+  void rearm(void);
+  bool tripped(void) { return _tripped; }
+  // True once for each trip, so it can be reported to the cabs
+  bool take_report(void);
+  // Force a trip on the next tick, to check the reaction time
+  void inject(void);
+  unsigned long reaction_us(void) { return _reaction_us; }
+};
+
+#endif
@@ -14,10 +14,12 @@
 const byte PIN_CBUS_LED_GRN = 17;
 const byte PIN_CBUS_LED_YEL = 16;
 const byte PIN_CBUS_SW = 4;
+const byte PIN_STATUS_LED = 2; // On board LED, session count and fault codes. Set to 0 if not fitted
 
 const byte PIN_BEMF0 = 33; // ADC 1_5 is Physical pin 8
 const byte PIN_BEMF1 = 27; // ABC 2_7 is Physical pin 11
 const byte PIN_POT = 15; // # ADC 2_3 is Physical pin 4
+const byte PIN_ISENSE = 0; // Current sense, not fitted. Boards with the sense resistor on ADC 1_4 (physical pin 7) set 32
 
 const byte PIN_BLNK0 = 14;
 const byte PIN_BLNK1 = 12;
@@ -20,16 +20,38 @@
 #include "pindefs_dc_controller_esp32.h"
 #include "throttle.h"
 #include "dc_controller.h"
+#include "task_scheduler.h"
+#include "adc_calibration.h"
 
 //
 /// setup - runs once at power on
 //
-dc_controller Controller;
+adc_calibration AdcCal;
+pot_dc_controller Controller;
+LEDControl ledRun, ledFault;         // running, and fault codes
+unsigned long faultShownAt = 0;
+task_scheduler Scheduler;
+
+void waveTask();
+void inputTask();
+void ledTask();
 
 void setup() {
 
-  Controller = dc_controller();  // Instantiate and initialise dc_controller
+  // ADC linearisation first, the controller reads the pot as it starts
+  AdcCal.begin();
+  Controller = pot_dc_controller();  // Instantiate and initialise dc_controller
+
+  ledRun.setPin(PIN_CBUS_LED_GRN);
+  ledRun.on();
+  ledFault.setPin(PIN_CBUS_LED_YEL);
+  ledFault.off();
 
+  // tasks, highest priority first
+  Scheduler.add("wave", waveTask, 1000);
+  Scheduler.add("inputs", inputTask, INPUT_SAMPLE_MS * 1000);
+  Scheduler.add("leds", ledTask, 10000);
+  Scheduler.start();
 }
 
 //
@@ -38,14 +60,33 @@ void setup() {
 
 void loop() {
 
-  //
-  /// do CBUS message, switch and LED processing
-  //
-  // check reversing switch
-  
-  Controller.update();
-  // Delay is included in above call
-  
+  Scheduler.run();
+}
+
+// waveform, one tick every 1ms
+void waveTask() {
+
+  Controller.tick();
+}
+
+// pot and direction switch, away from the waveform phases
+void inputTask() {
+
+  Controller.sample_inputs();
+}
+
+void ledTask() {
+
+  // LEDs run from their own timers, they only need telling about changes
+  if (Controller.overload_report())
+  {
+    ledFault.code(FAULT_OVERLOAD);
+    faultShownAt = millis();
+  }
+  else if ((millis() - faultShownAt) >= FAULT_SHOW_MS)
+  {
+    ledFault.off();
+  }
 }
 
 
@@ -0,0 +1,129 @@
+//
+//  scope_capture.cpp
+//
+//  Oscilloscope style capture of the DC controller waveform, for tuning.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "scope_capture.h"
+
+scope_capture::scope_capture(void)
+{
+  _state = SCOPE_IDLE;
+  _trigger = SCOPE_TRIGGER_NOW;
+  _threshold = SCOPE_DEFAULT_BEMF_THRESHOLD;
+  _next = 0;
+  _count = 0;
+  _remaining = 0;
+  _last_flags = 0;
+}
+
+void scope_capture::arm(t_scope_trigger trigger, int threshold)
+{
+  _state = SCOPE_IDLE;
+  _trigger = trigger;
+  _threshold = threshold;
+  _next = 0;
+  _count = 0;
+  _remaining = SCOPE_POST_TRIGGER;
+  _last_flags = 0;
+  _state = SCOPE_ARMED;
+}
+
+void scope_capture::stop(void)
+{
+  if (_state != SCOPE_IDLE)
+  {
+    _state = SCOPE_DONE;
+  }
+}
+
+bool scope_capture::triggered(const t_scope_sample *sample)
+{
+  switch (_trigger)
+  {
+    case SCOPE_TRIGGER_DIRECTION:
+      return (_count > 0) && ((sample->flags ^ _last_flags) & SCOPE_FLAG_FORWARDS);
+    case SCOPE_TRIGGER_BEMF_ABOVE:
+      return (sample->flags & SCOPE_FLAG_BEMF_READ) && (sample->bemf > _threshold);
+    case SCOPE_TRIGGER_BEMF_BELOW:
+      return (sample->flags & SCOPE_FLAG_BEMF_READ) && (sample->bemf < _threshold);
+    default:
+      return true;
+  }
+}
+
+void scope_capture::sample(byte phase, byte output, uint16_t bemf, int requested, byte flags)
+{
+  t_scope_sample *sample = &_ring[_next];
+  sample->phase = phase;
+  sample->output = output;
+  sample->flags = flags;
+  sample->reserved = 0;
+  sample->bemf = bemf;
+  sample->requested = requested;
+  _next = (_next + 1) & (SCOPE_SAMPLES - 1);
+  if (_count < SCOPE_SAMPLES)
+  {
+    _count++;
+  }
+  if ((_state == SCOPE_ARMED) && triggered(sample))
+  {
+    sample->flags |= SCOPE_FLAG_TRIGGER;
+    _state = SCOPE_TRIGGERED;
+  }
+  _last_flags = flags;
+  if ((_state == SCOPE_TRIGGERED) && (--_remaining == 0))
+  {
+    _state = SCOPE_DONE;
+  }
+}
+
+unsigned int scope_capture::read(unsigned int first, t_scope_sample *out, unsigned int max)
+{
+  // Oldest sample is at _next once the ring has filled, otherwise at 0
+  unsigned int oldest = (_count < SCOPE_SAMPLES) ? 0 : _next;
+  unsigned int copied = 0;
+  while ((copied < max) && ((first + copied) < _count))
+  {
+    out[copied] = _ring[(oldest + first + copied) & (SCOPE_SAMPLES - 1)];
+    copied++;
+  }
+  return copied;
+}
+
+// One sample line, false once past the end of the capture
+bool scope_capture::dump_sample(Print &out, unsigned int index)
+{
+  t_scope_sample sample;
+  if (read(index, &sample, 1) != 1)
+  {
+    return false;
+  }
+  out.print(F("s,"));
+  out.print(index);
+  out.print(',');
+  out.print(sample.phase);
+  out.print(',');
+  out.print(sample.output);
+  out.print(',');
+  out.print(sample.bemf);
+  out.print(',');
+  out.print(sample.requested);
+  out.print(',');
+  out.println(sample.flags);
+  return true;
+}
+
+void scope_capture::dump(Print &out)
+{
+  out.println(F(SCOPE_DUMP_HEADER));
+  for (unsigned int index = 0; dump_sample(out, index); index++)
+  {
+  }
+  out.println(F(SCOPE_DUMP_END));
+}
@@ -0,0 +1,101 @@
+//
+//  scope_capture.h
+//
+//  Oscilloscope style capture of the DC controller waveform, for tuning.
+//
+//  When armed, every waveform tick records the output sample written, the BEMF last
+//  read, the blanking state and the requested level into a preallocated ring.
+//  Recording costs one store per tick, with no allocation and no prints.
+//  The ring runs continuously while armed, and once the trigger condition is met
+//  a further SCOPE_POST_TRIGGER samples are taken and capture stops, so the samples
+//  before the trigger are kept as well. The capture can then be read out in order,
+//  oldest first, for printing on the serial port or sending as long messages.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef scope_capture_h
+#define scope_capture_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+
+const unsigned int SCOPE_SAMPLES = 256;                   // Ring size, a power of 2, 16 waveform cycles
+const unsigned int SCOPE_POST_TRIGGER = SCOPE_SAMPLES - 32; // Samples kept after the trigger
+const int SCOPE_DEFAULT_BEMF_THRESHOLD = MAX_BEMF_LEVEL / 2;
+
+#define SCOPE_DUMP_HEADER "# scope index,phase,output,bemf,requested,flags"
+#define SCOPE_DUMP_END "# end"
+
+// Sample flags
+const byte SCOPE_FLAG_BLANKING = 0x01;                    // Output blanked on this tick
+const byte SCOPE_FLAG_FORWARDS = 0x02;
+const byte SCOPE_FLAG_BEMF_READ = 0x04;                   // BEMF was read on this tick
+const byte SCOPE_FLAG_CUT = 0x08;                         // Output cut by overload protection
+const byte SCOPE_FLAG_TRIGGER = 0x80;                     // The trigger sample
+
+typedef enum
+{
+  SCOPE_TRIGGER_NOW,                                      // Trigger as soon as armed
+  SCOPE_TRIGGER_DIRECTION,                                // Trigger on a change of direction
+  SCOPE_TRIGGER_BEMF_ABOVE,                               // Trigger when the BEMF rises above the threshold
+  SCOPE_TRIGGER_BEMF_BELOW,                               // Trigger when the BEMF falls below the threshold
+} t_scope_trigger;
+
+typedef enum
+{
+  SCOPE_IDLE,
+  SCOPE_ARMED,                                            // Recording, waiting for the trigger
+  SCOPE_TRIGGERED,                                        // Recording the samples after the trigger
+  SCOPE_DONE,                                             // Capture complete, ready to read
+} t_scope_state;
+
+typedef struct
+{
+  byte phase;
+  byte output;                                            // DAC sample written
+  byte flags;
+  byte reserved;
+  uint16_t bemf;
+  int16_t requested;
+} t_scope_sample;
+
+class scope_capture
+{
+  t_scope_sample _ring[SCOPE_SAMPLES];
+  volatile t_scope_state _state;
+  t_scope_trigger _trigger;
+  int _threshold;
+  unsigned int _next;                                     // Where the next sample goes
+  unsigned int _count;                                    // Samples recorded, up to SCOPE_SAMPLES
+  unsigned int _remaining;                                // Samples still to take after the trigger
+  byte _last_flags;
+
+  bool triggered(const t_scope_sample *sample);
+
+public:
+  scope_capture(void);
+  void arm(t_scope_trigger trigger, int threshold);
+  void stop(void);
+  t_scope_state state(void) { return _state; }
+  bool done(void) { return (_state == SCOPE_DONE); }
+  // Called on every waveform tick, only does anything while armed
+  void record(byte phase, byte output, uint16_t bemf, int requested, byte flags)
+  {
+    if ((_state == SCOPE_ARMED) || (_state == SCOPE_TRIGGERED))
+    {
+      sample(phase, output, bemf, requested, flags);
+    }
+  }
+  void sample(byte phase, byte output, uint16_t bemf, int requested, byte flags);
+  // Samples held, and a copy of them oldest first
+  unsigned int count(void) { return _count; }
+  unsigned int read(unsigned int first, t_scope_sample *out, unsigned int max);
+  // Print the capture as comma separated lines, for tools/plot_capture.py.
+  // dump_sample() prints one line, so a long dump can be spread over several passes of loop()
+  void dump(Print &out);
+  bool dump_sample(Print &out, unsigned int index);
+};
+
+#endif
@@ -0,0 +1,88 @@
+//
+//  speed_curve.cpp
+//
+//  Per controller speed curve for the CBUS DC controller.
+//  All interpolation is done when the curve is set, not when it is used.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "speed_curve.h"
+
+speed_curve::speed_curve(void)
+{
+  set_linear();
+}
+
+// Scale a curve point (0..255) to a throttle level (0..MAX_THROTTLE_LEVEL)
+int speed_curve::point_to_level(byte point)
+{
+  return ((long)point * MAX_THROTTLE_LEVEL) / SPEED_CURVE_MAX_POINT;
+}
+
+// Fill the table between two steps with a straight line, end points included
+void speed_curve::interpolate(byte from_step, int from_level, byte to_step, int to_level)
+{
+  int span = to_step - from_step;
+  for (int step = from_step; step <= to_step; step++)
+  {
+    if (span == 0)
+    {
+      _table[step] = to_level;
+    }
+    else
+    {
+      _table[step] = from_level + (((long)(to_level - from_level) * (step - from_step)) / span);
+    }
+  }
+}
+
+// Default, CBUS speed step maps directly on to throttle level
+void speed_curve::set_linear(void)
+{
+  set_curve(0, 0, 0);
+}
+
+// Three point curve, Vstart at step 2, Vmid at step 64, Vmax at step 127
+// Vmax or Vmid left at zero are filled in, so all three zero gives the linear default,
+// and the curve never falls as the speed step rises
+void speed_curve::set_curve(byte vstart, byte vmid, byte vmax)
+{
+  if (vmax == 0)
+  {
+    vmax = SPEED_CURVE_MAX_POINT;
+  }
+  if (vmax < vstart)
+  {
+    vmax = vstart;
+  }
+  if (vmid == 0)
+  {
+    // No mid point given, so put it on the straight line between start and max
+    vmid = vstart + ((vmax - vstart) / 2);
+  }
+  vmid = constrain(vmid, vstart, vmax);
+  // Steps 0 (stop) and 1 (emergency stop) never drive the output
+  _table[0] = 0;
+  _table[1] = 0;
+  interpolate(2, point_to_level(vstart), SPEED_CURVE_MID_STEP, point_to_level(vmid));
+  interpolate(SPEED_CURVE_MID_STEP, point_to_level(vmid), SPEED_CURVE_STEPS - 1, point_to_level(vmax));
+}
+
+// 28 point table, spread evenly over CBUS speed steps 2..127
+void speed_curve::set_table(const byte *points)
+{
+  byte from_step = 2;
+  byte to_step;
+  _table[0] = 0;
+  _table[1] = 0;
+  for (byte point = 1; point < SPEED_TABLE_POINTS; point++)
+  {
+    to_step = 2 + ((point * (SPEED_CURVE_STEPS - 3)) / (SPEED_TABLE_POINTS - 1));
+    interpolate(from_step, point_to_level(points[point - 1]), to_step, point_to_level(points[point]));
+    from_step = to_step;
+  }
+}
@@ -0,0 +1,45 @@
+//
+//  speed_curve.h
+//
+//  Per controller (and so per DCC address) speed curve for the CBUS DC controller.
+//
+//  The curve is held compactly as three points (Vstart, Vmid, Vmax),
+//  or as an NMRA style 28 point table, and is expanded once into a
+//  lookup table of 128 entries, one per CBUS speed step.
+//  Looking up an output level on the speed change path is then a single array read.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef speed_curve_h
+#define speed_curve_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+
+const byte SPEED_CURVE_STEPS = 128;    // CBUS speed steps, 0 = stop, 1 = emergency stop, 2..127 running
+const byte SPEED_TABLE_POINTS = 28;    // Points in a full speed table
+const byte SPEED_CURVE_MID_STEP = 64;  // CBUS speed step that Vmid is applied to
+const byte SPEED_CURVE_MAX_POINT = 255;// Full scale of Vstart, Vmid, Vmax and speed table points
+
+// Each controller's Vstart, Vmid, Vmax are stored in NVs, see cbus_module_defs.h
+// All three zero means no curve stored, so a linear mapping is used
+
+class speed_curve
+{
+  uint16_t _table[SPEED_CURVE_STEPS];
+
+  void interpolate(byte from_step, int from_level, byte to_step, int to_level);
+  int point_to_level(byte point);
+
+public:
+  speed_curve(void);
+  void set_linear(void);
+  void set_curve(byte vstart, byte vmid, byte vmax);
+  void set_table(const byte *points);
+  // Throttle level (0..MAX_THROTTLE_LEVEL) for a CBUS speed step (0..127)
+  uint16_t lookup(byte speed_step) { return _table[speed_step & 0x7f]; }
+};
+
+#endif
@@ -0,0 +1,109 @@
+//
+//  speed_source.h
+//
+//  Speed sources for the DC controller core.
+//
+//  dc_controller_core takes one of these as a template parameter, so the source of the
+//  requested level and direction is fixed at compile time and its calls are inlined.
+//  A source provides:
+//    setup()     once, from the controller constructor
+//    sample()    every INPUT_SAMPLE_MS, from a scheduled task
+//    level()     requested level, 0..MAX_THROTTLE_LEVEL, read once a waveform cycle
+//    forwards()  direction, only taken while the level is below MIN_REQUESTED_LEVEL
+//    stop()      emergency stop, the level stays at zero until set again
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef speed_source_h
+#define speed_source_h
+
+#include <arduino.h>
+#include "dc_controller_defs.h"
+#include "pindefs_dc_controller_esp32.h"
+#include "input_conditioner.h"
+
+// Standalone controller, speed pot and direction switch
+class pot_speed_source
+{
+  input_conditioner _inputs;
+
+public:
+  void setup(void) { _inputs.setup(PIN_POT, PIN_DIR); }
+  void sample(void) { _inputs.sample(); }
+  int level(void) { return _inputs.level(); }
+  bool forwards(void) { return _inputs.forwards(); }
+  // The pot is where the driver left it, the output cut holds until it is turned to zero
+  void stop(void) { }
+};
+
+// CBUS controller, set by the train controller from the session speed
+class cbus_speed_source
+{
+  int _level;
+  bool _forwards;
+
+public:
+  cbus_speed_source(void) : _level(0), _forwards(true) { }
+  void setup(void) { }
+  void sample(void) { }
+  int level(void) { return _level; }
+  bool forwards(void) { return _forwards; }
+  void stop(void) { _level = 0; }
+  // Speed is a throttle level (0..MAX_THROTTLE_LEVEL), already mapped through the speed curve
+  void setSpeedAndDirection(int speed, bool direction)
+  {
+    _level = speed;
+    _forwards = direction;
+  }
+};
+
+// Test and benchmark runs, a list of timed steps played from start()
+typedef struct
+{
+  unsigned long at_ms;                     // From the start of the script
+  int level;
+  bool forwards;
+} t_script_step;
+
+class scripted_speed_source
+{
+  const t_script_step *_steps;
+  byte _count;
+  byte _next;
+  unsigned long _start_ms;
+  int _level;
+  bool _forwards;
+
+public:
+  scripted_speed_source(void) : _steps(NULL), _count(0), _next(0), _start_ms(0), _level(0), _forwards(true) { }
+  void setup(void) { }
+  void start(const t_script_step *steps, byte count)
+  {
+    _steps = steps;
+    _count = count;
+    _next = 0;
+    _start_ms = millis();
+    sample();
+  }
+  void sample(void)
+  {
+    while ((_next < _count) && ((millis() - _start_ms) >= _steps[_next].at_ms))
+    {
+      _level = _steps[_next].level;
+      _forwards = _steps[_next].forwards;
+      _next++;
+    }
+  }
+  int level(void) { return _level; }
+  bool forwards(void) { return _forwards; }
+  void stop(void)
+  {
+    _level = 0;
+    _next = _count;
+  }
+  bool finished(void) { return (_next >= _count); }
+};
+
+#endif
@@ -0,0 +1,116 @@
+//
+//  task_scheduler.cpp
+//
+//  Cooperative fixed period scheduler for the DC controller sketches.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#include <arduino.h>
+#include "task_scheduler.h"
+
+task_scheduler::task_scheduler(void)
+{
+  _count = 0;
+}
+
+bool task_scheduler::add(const char *name, t_task_function function, unsigned long period_us)
+{
+  t_task *task;
+  if ((_count >= SCHED_MAX_TASKS) || (function == NULL) || (period_us == 0))
+  {
+    return false;
+  }
+  task = &_tasks[_count++];
+  memset(task, 0, sizeof(t_task));
+  task->name = name;
+  task->function = function;
+  task->period_us = period_us;
+  task->release_us = micros();
+  return true;
+}
+
+void task_scheduler::start(void)
+{
+  unsigned long now = micros();
+  for (byte i = 0; i < _count; i++)
+  {
+    _tasks[i].release_us = now;
+  }
+}
+
+void task_scheduler::run(void)
+{
+  t_task *task;
+  unsigned long now = micros();
+  unsigned long late;
+  unsigned long run_us;
+  for (byte i = 0; i < _count; i++)
+  {
+    task = &_tasks[i];
+    late = now - task->release_us;
+    // Not yet due, the difference wraps to a large value
+    if (late >= 0x80000000UL)
+    {
+      continue;
+    }
+    if (late >= task->period_us)
+    {
+      // A whole period or more behind, drop the releases missed
+      task->missed += late / task->period_us;
+      task->release_us += (late / task->period_us) * task->period_us;
+      late = late % task->period_us;
+    }
+    if (late > task->jitter_max_us)
+    {
+      task->jitter_max_us = late;
+    }
+    task->release_us += task->period_us;
+    task->function();
+    run_us = micros() - now;
+    task->runs++;
+    task->run_total_us += run_us;
+    if (run_us > task->run_max_us)
+    {
+      task->run_max_us = run_us;
+    }
+    return;
+  }
+}
+
+void task_scheduler::report(Print &out)
+{
+  t_task *task;
+  out.println(F("> tasks: name, period us, runs, missed, run avg us, run max us, jitter max us"));
+  for (byte i = 0; i < _count; i++)
+  {
+    task = &_tasks[i];
+    out.print(F("  "));
+    out.print(task->name);
+    out.print(F(", "));
+    out.print(task->period_us);
+    out.print(F(", "));
+    out.print(task->runs);
+    out.print(F(", "));
+    out.print(task->missed);
+    out.print(F(", "));
+    out.print((task->runs > 0) ? (unsigned long)(task->run_total_us / task->runs) : 0UL);
+    out.print(F(", "));
+    out.print(task->run_max_us);
+    out.print(F(", "));
+    out.println(task->jitter_max_us);
+  }
+}
+
+void task_scheduler::reset_stats(void)
+{
+  for (byte i = 0; i < _count; i++)
+  {
+    _tasks[i].runs = 0;
+    _tasks[i].missed = 0;
+    _tasks[i].run_total_us = 0;
+    _tasks[i].run_max_us = 0;
+    _tasks[i].jitter_max_us = 0;
+  }
+}
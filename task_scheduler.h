@@ -0,0 +1,59 @@
+//
+//  task_scheduler.h
+//
+//  Cooperative fixed period scheduler for the DC controller sketches.
+//
+//  Each task is a function that runs to completion, released every period. Tasks are
+//  in priority order, the order they were added, and run() starts at most one of them:
+//  the highest priority task that is due. So with loop() calling run(), a task waits
+//  at most for one lower priority task to finish, which is what the waveform tick
+//  relies on. Release times advance by whole periods, so a late task does not drift,
+//  and a task that falls a whole period behind counts the releases it missed rather
+//  than running them back to back.
+//  For each task the scheduler keeps the run time (average and worst) and the jitter,
+//  the worst delay from release to start.
+//
+// (c) Ian Blair 18th. October 2026
+//
+// For license and attributions see associated readme file
+//
+#ifndef task_scheduler_h
+#define task_scheduler_h
+
+#include <arduino.h>
+
+const byte SCHED_MAX_TASKS = 8;
+
+typedef void (*t_task_function)(void);
+
+typedef struct
+{
+  const char *name;
+  t_task_function function;
+  unsigned long period_us;
+  unsigned long release_us;                 // When the task is next due
+  unsigned long runs;
+  unsigned long missed;                     // Releases skipped because the task was a period late
+  uint64_t run_total_us;
+  unsigned long run_max_us;
+  unsigned long jitter_max_us;
+} t_task;
+
+class task_scheduler
+{
+  t_task _tasks[SCHED_MAX_TASKS];
+  byte _count;
+
+public:
+  task_scheduler(void);
+  // Add a task, lower priority than those already added. False if there is no room.
+  bool add(const char *name, t_task_function function, unsigned long period_us);
+  // Release every task now
+  void start(void);
+  // Called from loop(), runs the highest priority task that is due, if any
+  void run(void);
+  void report(Print &out);
+  void reset_stats(void);
+};
+
+#endif
@@ -9,6 +9,9 @@
 #include "dc_controller_defs.h"
 #include "pindefs_dc_controller_esp32.h"
 #include "throttle.h"
+#include "adc_calibration.h"
+
+extern adc_calibration AdcCal;
 
 throttle::throttle(void)
 {   
@@ -30,7 +33,8 @@ void throttle::initialise(byte throttle_dac_id, byte bemf_adc_pin_id, byte blnk_
 int throttle::adc_read(byte adc_pin_id)
 {
   int _adc_value;
-  _adc_value = analogRead(adc_pin_id);
+  // Linearised through the chip's ADC calibration
+  _adc_value = AdcCal.read(adc_pin_id);
   return (_adc_value);
 }
        
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+#  plot_capture.py
+#
+#  Plot a scope capture from the CBUS DC controller.
+#
+#  Arm the capture with 'o' (direction change) or 'O' (BEMF threshold) on the serial
+#  port, then save the output of 'p' to a file and plot it with
+#      python3 plot_capture.py capture.txt
+#  Lines other than the 's,...' sample lines are ignored, so the whole serial log can
+#  be given. Needs matplotlib.
+#
+# (c) Ian Blair 18th. October 2026
+#
+# For license and attributions see associated readme file
+#
+import sys
+
+import matplotlib.pyplot as plt
+
+FLAG_BLANKING = 0x01
+FLAG_FORWARDS = 0x02
+FLAG_BEMF_READ = 0x04
+FLAG_CUT = 0x08
+FLAG_TRIGGER = 0x80
+
+
+def read_capture(lines):
+    samples = []
+    for line in lines:
+        fields = line.strip().split(',')
+        if len(fields) != 7 or fields[0] != 's':
+            continue
+        index, phase, output, bemf, requested, flags = (int(f) for f in fields[1:])
+        samples.append((index, phase, output, bemf, requested, flags))
+    return samples
+
+
+def plot_capture(samples, title):
+    index = [s[0] for s in samples]
+    output = [s[2] for s in samples]
+    requested = [s[4] for s in samples]
+    blanking = [1 if s[5] & FLAG_BLANKING else 0 for s in samples]
+    forwards = [1 if s[5] & FLAG_FORWARDS else 0 for s in samples]
+    # BEMF is only measured once a cycle, so only plot the fresh readings
+    bemf = [(s[0], s[3]) for s in samples if s[5] & FLAG_BEMF_READ]
+    cut = [s[0] for s in samples if s[5] & FLAG_CUT]
+    trigger = [s[0] for s in samples if s[5] & FLAG_TRIGGER]
+
+    fig, (ax_out, ax_bemf, ax_state) = plt.subplots(3, 1, sharex=True)
+    fig.suptitle(title)
+    ax_out.step(index, output, where='post', label='output sample')
+    ax_out.set_ylabel('DAC')
+    ax_out.legend(loc='upper right')
+    ax_bemf.plot([b[0] for b in bemf], [b[1] for b in bemf], 'o-', label='BEMF')
+    ax_bemf.plot(index, requested, label='requested level')
+    ax_bemf.set_ylabel('ADC')
+    ax_bemf.legend(loc='upper right')
+    ax_state.step(index, blanking, where='post', label='blanking')
+    ax_state.step(index, [f + 2 for f in forwards], where='post', label='forwards')
+    ax_state.set_yticks([0, 1, 2, 3])
+    ax_state.set_xlabel('tick (ms)')
+    ax_state.legend(loc='upper right')
+    for ax in (ax_out, ax_bemf, ax_state):
+        for t in trigger:
+            ax.axvline(t, color='red', linestyle='--')
+        for c in cut:
+            ax.axvspan(c, c + 1, color='orange', alpha=0.3)
+    plt.show()
+
+
+def main():
+    if len(sys.argv) != 2:
+        print('usage: plot_capture.py capture.txt')
+        return 1
+    with open(sys.argv[1]) as f:
+        samples = read_capture(f)
+    if not samples:
+        print('no samples found')
+        return 1
+    plot_capture(samples, sys.argv[1])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -234,65 +234,129 @@ void trainControllerClass::initialise(void)
 
   // -------------------------------------------------
 };
-#elseif DAC_BEMF
+#else
+
+// DAC outputs with BEMF regulation, through the dc_controller
+
+#include "dc_controller.h"
+
+extern dc_controller Controller;
 
 // -------------------------------------------------
 
-void matchToTargets ();
+void trainControllerClass::setControllerTargets (int newLocoDirection, int newLocoSpeed)
+{
+  // Just set the target speed and direction. matchToTargets() is responsible for changing actuals to match.
+  targetLocoSpeed = newLocoSpeed;
+  targetLocoDirection = newLocoDirection;
+  eStopped = false;
+}
+
 // -------------------------------------------------
 
-  void emergencyStop ()
+void trainControllerClass::matchToTargets ()
+{
+  // only do anything if speed or direction does not match
+  if (!eStopped && ((targetLocoSpeed != currentLocoSpeed) || (targetLocoDirection != currentLocoDirection)))
   {
-    eStopped = true;
-    noInterrupts();
-    analogWrite(pinPWM, 0);
-    targetLocoSpeed = 0;
-    currentLocoSpeed = 0;
-    interrupts();
+    if (targetLocoDirection != currentLocoDirection)
+    {
+      // need to decellerate to zero first
+      if (currentLocoSpeed < SPEED_STEP)
+      {
+        currentLocoSpeed = 0;
+        currentLocoDirection = targetLocoDirection;
+      }
+      else
+      {
+        currentLocoSpeed = currentLocoSpeed - SPEED_STEP;
+      }
+    }
+    else if (currentLocoSpeed > targetLocoSpeed)
+    {
+      // need to decellerate
+      if (targetLocoSpeed + SPEED_STEP > currentLocoSpeed)
+        currentLocoSpeed = targetLocoSpeed;
+      else
+        currentLocoSpeed = currentLocoSpeed - SPEED_STEP;
+    }
+    else
+    {
+      // need to accellerate
+      if (currentLocoSpeed + SPEED_STEP > targetLocoSpeed)
+        currentLocoSpeed = targetLocoSpeed;
+      else
+        currentLocoSpeed = currentLocoSpeed + SPEED_STEP;
+    }
+    // Speed step is mapped on to a throttle level by the precomputed speed curve,
+    // and the output is regulated for this loco's motor
+    Controller.set_motor_params(motorParams);
+    Controller.source().setSpeedAndDirection(speedCurve.lookup(currentLocoSpeed), (currentLocoDirection == SF_FORWARDS));
   }
+}
 
-  // -------------------------------------------------
+// -------------------------------------------------
 
-  void setSpeedAndDirection (int newLocoDirection, int newLocoSpeed)
-  {
-    bool forward_not_backwards;
-    int requestedSpeed = 2* newLocoDirection;
-    if (newLocoDirection == SF_FORWARDS) forward_not_backwards = true;
-    else forward_not_backwards = false;
-    Controller.setSpeedAndDtection(requestedSpeed, forward_not_backwards);
-  }
+void trainControllerClass::emergencyStop ()
+{
+  eStopped = true;
+  noInterrupts();
+  targetLocoSpeed = 0;
+  currentLocoSpeed = 0;
+  interrupts();
+  Controller.source().setSpeedAndDirection(0, (currentLocoDirection == SF_FORWARDS));
+}
 
-  // -------------------------------------------------
+// -------------------------------------------------
 
-  void setSpeed (int newLocoSpeed)
-  {
-    setControllerTargets(targetLocoDirection, newLocoSpeed);
-  }
+void trainControllerClass::setSpeedAndDirection (int newLocoDirection, int newLocoSpeed)
+{
+  setControllerTargets(newLocoDirection, newLocoSpeed);
+}
 
-  // -------------------------------------------------
+// -------------------------------------------------
 
-  uint8_t getSpeed ()
-  {
-    return targetLocoSpeed; //currentLocoSpeed;
-  }
+void trainControllerClass::setSpeed (int newLocoSpeed)
+{
+  setControllerTargets(targetLocoDirection, newLocoSpeed);
+}
 
-  // -------------------------------------------------
+// -------------------------------------------------
 
-  uint8_t getDirection ()
-  {
-    return targetLocoDirection;//currentLocoDirection;
-  }
+uint8_t trainControllerClass::getSpeed ()
+{
+  return targetLocoSpeed; //currentLocoSpeed;
+}
 
-  // -------------------------------------------------
+// -------------------------------------------------
 
-  void setPWMFrequency ()
-  {
-      // Default frequency used so far ontroller
-      // Use this call to set up and insrantiate the       
-      Controller = dc_controller();
-  }
+uint8_t trainControllerClass::getDirection ()
+{
+  return targetLocoDirection;//currentLocoDirection;
+}
 
-  // -------------------------------------------------
-};
+// -------------------------------------------------
 
-#endif
\ No newline at end of file
+void trainControllerClass::setPWMFrequency ()
+{
+  // Not used for DAC outputs, the dc_controller sets its own update rate
+  ;
+}
+
+// -------------------------------------------------
+
+void trainControllerClass::setSpeedCurve (byte vstart, byte vmid, byte vmax)
+{
+  speedCurve.set_curve(vstart, vmid, vmax);
+}
+
+// -------------------------------------------------
+
+void trainControllerClass::setSpeedTable (const byte *points)
+{
+  speedCurve.set_table(points);
+}
+
+// -------------------------------------------------
+
+#endif
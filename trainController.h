@@ -9,6 +9,8 @@
 #define trainController_h
 
 #include "arduino.h"
+#include "speed_curve.h"
+#include "motor_profile.h"
 // Analogue (PWM) Train Controller.
 //
 // Class: trainControllerClass
@@ -22,6 +24,10 @@
 //      uint8_t getSpeed ()
 //      uint8_t getDirection ()
 //      void    setPWMFrequency ()
+//      void    setSpeedCurve (byte vstart, byte vmid, byte vmax)
+//      void    setSpeedTable (const byte *points)
+//      uint16_t getSpeedLevel (byte speedStep)
+//      void    setMotorParams (const t_motor_params &params)
 
 #define SF_FORWARDS    0x01      // Train is running forwards
 #define SF_REVERSE     0x00      // Train is running in reverse
@@ -38,6 +44,8 @@ class trainControllerClass
   int      pinA;
   int      pinB;
   int      pinPWM;
+  speed_curve speedCurve;   // maps CBUS speed steps on to throttle levels
+  t_motor_params motorParams = MOTOR_DEFAULTS;   // BEMF regulation for the loco on this address
 
 
   // -------------------------------------------------
@@ -96,6 +104,22 @@ class trainControllerClass
   void  setPWMFrequency (void);
 
   // -------------------------------------------------
+
+  void  setSpeedCurve (byte vstart, byte vmid, byte vmax);
+
+  // -------------------------------------------------
+
+  void  setSpeedTable (const byte *points);
+
+  // -------------------------------------------------
+
+  uint16_t getSpeedLevel (byte speedStep) { return speedCurve.lookup(speedStep); }
+
+  // -------------------------------------------------
+
+  void  setMotorParams (const t_motor_params &params) { motorParams = params; }
+
+  // -------------------------------------------------
 };
 
 #endif
\ No newline at end of file